@@ -24,24 +24,91 @@ typedef struct _sch_xml_to_gnode_parms_s
 {
     sch_instance *in_instance;
     int in_flags;
-    char *in_def_op;
+    nc_operation in_def_op;
     bool in_is_edit;
     GNode *out_tree;
     nc_error_parms out_error;
-    GList *out_deletes;
-    GList *out_removes;
-    GList *out_creates;
-    GList *out_replaces;
-    GList *out_merges;
-    GList *conditions;
+    /* Queues so large edits append in constant time */
+    GQueue out_deletes;
+    GQueue out_removes;
+    GQueue out_creates;
+    GQueue out_replaces;
+    GQueue out_merges;
+    GQueue conditions;
+    GHashTable *condition_set;
+    /* Set when decoding on a pool thread, which never dispatches again */
+    bool in_worker;
+    /* Skip elements that fail, keeping their errors, rather than stopping */
+    bool in_continue;
+    GQueue out_errors;
+    /* Paths for the edit queues and conditions above, all freed with the
+     * parms. Pool threads decode into their own and hand them over when
+     * their results merge. Get and filter decodes only build the tree, whose
+     * names outlive the parms, so they have no arena */
+    GStringChunk *arena;
+    GList *arenas;
 } _sch_xml_to_gnode_parms;
 
+/* Schema node properties used for every value, read once per node. Condition
+ * expressions are shared by every edit so identical ones compare by pointer */
+typedef struct _sch_node_info
+{
+    char *when;
+    char *must;
+    char *if_feature;
+    char *idref_href;
+    char *idref_prefix;
+    /* Name, and name without any prefix, from sch_names */
+    const xmlChar *name;
+    const xmlChar *local;
+    bool readable;
+    bool writable;
+} sch_node_info;
+
+/* Filled for every schema node before any session starts and only read
+ * after that, so it is shared by all threads without a lock. Any node the
+ * walk at start up did not reach is read on first use into a second table
+ * behind a lock */
+static GHashTable *sch_info_cache = NULL;
+static GHashTable *sch_info_late = NULL;
+static GMutex sch_info_lock;
+
+/* Every name in the schema, added once at load and only read after that, so
+ * it can be shared by all threads. Documents are parsed into dictionaries
+ * layered on it, giving schema names a single copy that compares by pointer */
+static xmlDict *sch_names = NULL;
+
+/* Edits with at least this many sibling elements under one node have the
+ * siblings decoded on the pool, when one is configured */
+#define SCH_PARALLEL_MIN_CHILDREN 64
+
+typedef struct _sch_decode_batch
+{
+    GMutex lock;
+    GCond cond;
+    int pending;
+} sch_decode_batch;
+
+typedef struct _sch_decode_job
+{
+    _sch_xml_to_gnode_parms *parms;
+    sch_node *schema;
+    sch_ns *ns;
+    char *xpath;
+    nc_operation op;
+    xmlNode *xml;
+    int depth;
+    GNode *tree;
+    sch_decode_batch *batch;
+} sch_decode_job;
+
+static GThreadPool *sch_decode_pool = NULL;
+
 /* List keys must escape any '/' which is the only reserved
    character in apteryx */
-static char *
-_sch_key_encode (const char *key)
+static void
+_sch_key_encode_append (GString *encoded, const char *key)
 {
-    GString *encoded = g_string_new (NULL);
     const char *c = key;
     while (c && *c)
     {
@@ -51,6 +118,13 @@ _sch_key_encode (const char *key)
             g_string_append_c (encoded, *c);
         c++;
     }
+}
+
+static char *
+_sch_key_encode (const char *key)
+{
+    GString *encoded = g_string_new (NULL);
+    _sch_key_encode_append (encoded, key);
     return g_string_free (encoded, false);
 }
 
@@ -134,35 +208,240 @@ sch_node_find_name (sch_instance *instance, xmlNs *ns, sch_node *parent, const c
 }
 
 static void
-sch_check_condition_parms (_sch_xml_to_gnode_parms *_parms, sch_node *node, char *new_xpath)
+sch_node_info_free (gpointer data)
+{
+    sch_node_info *info = (sch_node_info *) data;
+
+    g_free (info->when);
+    g_free (info->must);
+    g_free (info->if_feature);
+    g_free (info->idref_href);
+    g_free (info->idref_prefix);
+    g_free (info);
+}
+
+static char *
+sch_node_prop (sch_node *node, const char *name)
+{
+    xmlChar *prop = xmlGetProp ((xmlNode *) node, BAD_CAST name);
+    char *ret = prop ? g_strdup ((char *) prop) : NULL;
+
+    xmlFree (prop);
+    return ret;
+}
+
+/* Find the names of a schema node in sch_names */
+static void
+sch_node_names (sch_node *node, const xmlChar **name, const xmlChar **local)
 {
-    xmlChar *when_clause = xmlGetProp ((xmlNode *) node, BAD_CAST "when");
-    xmlChar *must_clause = xmlGetProp ((xmlNode *) node, BAD_CAST "must");
-    xmlChar *if_feature = xmlGetProp ((xmlNode *) node, BAD_CAST "if-feature");
+    char *full = sch_name (node);
+    char *colon = full ? strchr (full, ':') : NULL;
 
-    if (when_clause)
+    *name = *local = NULL;
+    if (full && sch_names)
     {
-        _parms->conditions = g_list_append (_parms->conditions, g_strdup (new_xpath));
-        _parms->conditions = g_list_append (_parms->conditions, g_strdup ((char *) when_clause));
-        DEBUG ("when_clause <%s - %s>\n", new_xpath, when_clause);
-        xmlFree (when_clause);
+        *name = xmlDictExists (sch_names, BAD_CAST full, -1);
+        *local = colon ? xmlDictExists (sch_names, BAD_CAST colon + 1, -1) : *name;
     }
+    g_free (full);
+}
 
-    if (must_clause)
+static void
+sch_names_add (sch_node *node)
+{
+    for (; node; node = sch_node_next_sibling (node))
     {
-        _parms->conditions = g_list_append (_parms->conditions, g_strdup (new_xpath));
-        _parms->conditions = g_list_append (_parms->conditions, g_strdup ((char *) must_clause));
-        DEBUG ("must_clause <%s - %s>\n", new_xpath, must_clause);
-        xmlFree (must_clause);
+        char *name = sch_name (node);
+        char *colon = name ? strchr (name, ':') : NULL;
+
+        if (name)
+            xmlDictLookup (sch_names, BAD_CAST name, -1);
+        if (colon)
+            xmlDictLookup (sch_names, BAD_CAST colon + 1, -1);
+        g_free (name);
+        sch_names_add (sch_node_child_first (node));
     }
+}
+
+/* Load every name in the schema, along with the NETCONF ones, before any session starts */
+void
+sch_names_init (sch_instance *instance)
+{
+    static const char *netconf_names[] = {
+        "nc", "rpc", "rpc-reply", "message-id", "hello", "capabilities", "capability",
+        "session-id", "get", "get-config", "edit-config", "filter", "type", "select",
+        "source", "target", "config", "data", "running", "candidate", "startup",
+        "default-operation", "operation", "with-defaults", "ok",
+    };
+
+    sch_names_free ();
+    sch_names = xmlDictCreate ();
+    for (int i = 0; i < G_N_ELEMENTS (netconf_names); i++)
+        xmlDictLookup (sch_names, BAD_CAST netconf_names[i], -1);
+    sch_names_add (sch_node_child_first (sch_get_root_schema (instance)));
+}
+
+void
+sch_names_free (void)
+{
+    if (sch_names)
+        xmlDictFree (sch_names);
+    sch_names = NULL;
+}
+
+xmlDict *
+sch_names_dict (void)
+{
+    return sch_names;
+}
 
+static sch_node_info *
+sch_node_info_new (sch_node *node)
+{
+    char *if_feature = sch_node_prop (node, "if-feature");
+    sch_node_info *info = g_malloc0 (sizeof (*info));
+
+    info->when = sch_node_prop (node, "when");
+    info->must = sch_node_prop (node, "must");
     if (if_feature)
+        info->if_feature = g_strdup_printf ("if-feature(%s)", if_feature);
+    g_free (if_feature);
+    info->idref_href = sch_node_prop (node, "idref_href");
+    if (info->idref_href)
+        info->idref_prefix = sch_node_prop (node, "idref_prefix");
+    info->readable = sch_is_readable (node);
+    info->writable = sch_is_writable (node);
+    sch_node_names (node, &info->name, &info->local);
+    return info;
+}
+
+static void
+sch_node_info_add (sch_node *node)
+{
+    for (; node; node = sch_node_next_sibling (node))
+    {
+        g_hash_table_insert (sch_info_cache, node, sch_node_info_new (node));
+        sch_node_info_add (sch_node_child_first (node));
+    }
+}
+
+/* Read the properties of every schema node, after sch_names_init */
+void
+sch_node_info_init (sch_instance *instance)
+{
+    sch_node_info_cache_free ();
+    sch_info_cache = g_hash_table_new_full (NULL, NULL, NULL, sch_node_info_free);
+    sch_info_late = g_hash_table_new_full (NULL, NULL, NULL, sch_node_info_free);
+    sch_node_info_add (sch_node_child_first (sch_get_root_schema (instance)));
+}
+
+/* Find the properties of a schema node */
+static sch_node_info *
+sch_node_info_get (sch_node *node)
+{
+    sch_node_info *info = sch_info_cache ? g_hash_table_lookup (sch_info_cache, node) : NULL;
+
+    if (info)
+        return info;
+
+    g_mutex_lock (&sch_info_lock);
+    if (!sch_info_late)
+        sch_info_late = g_hash_table_new_full (NULL, NULL, NULL, sch_node_info_free);
+    info = g_hash_table_lookup (sch_info_late, node);
+    if (!info)
+    {
+        info = sch_node_info_new (node);
+        g_hash_table_insert (sch_info_late, node, info);
+    }
+    g_mutex_unlock (&sch_info_lock);
+    return info;
+}
+
+/* The name of a schema node as it appears in sch_names. Parsed documents
+ * share the pointer, so compare with that before falling back to the text */
+const xmlChar *
+sch_node_xml_name (sch_node *node, bool local)
+{
+    sch_node_info *info = sch_node_info_get (node);
+
+    return local ? info->local : info->name;
+}
+
+/* Forget the cached node properties, which belong to the schema */
+void
+sch_node_info_cache_free (void)
+{
+    if (sch_info_cache)
+        g_hash_table_destroy (sch_info_cache);
+    sch_info_cache = NULL;
+    g_mutex_lock (&sch_info_lock);
+    if (sch_info_late)
+        g_hash_table_destroy (sch_info_late);
+    sch_info_late = NULL;
+    g_mutex_unlock (&sch_info_lock);
+}
+
+static guint
+sch_condition_hash (gconstpointer data)
+{
+    const sch_condition *cond = data;
+    return g_str_hash (cond->path) ^ g_direct_hash (cond->condition);
+}
+
+static gboolean
+sch_condition_equal (gconstpointer a, gconstpointer b)
+{
+    const sch_condition *ca = a;
+    const sch_condition *cb = b;
+    return ca->condition == cb->condition && g_strcmp0 (ca->path, cb->path) == 0;
+}
+
+/* Queue a condition, once for each path it needs checking at */
+static void
+sch_add_condition (_sch_xml_to_gnode_parms *_parms, const char *path, const char *condition)
+{
+    sch_condition lookup = { (char *) path, (char *) condition };
+    sch_condition *cond;
+
+    if (g_hash_table_contains (_parms->condition_set, &lookup))
+        return;
+
+    cond = g_malloc (sizeof (*cond));
+    cond->path = g_string_chunk_insert (_parms->arena, path);
+    cond->condition = (char *) condition;
+    g_queue_push_tail (&_parms->conditions, cond);
+    g_hash_table_add (_parms->condition_set, cond);
+}
+
+static void
+sch_condition_free (gpointer data)
+{
+    sch_condition *cond = (sch_condition *) data;
+
+    g_free (cond);
+}
+
+static void
+sch_check_condition_parms (_sch_xml_to_gnode_parms *_parms, sch_node *node, char *new_xpath)
+{
+    sch_node_info *info = sch_node_info_get (node);
+
+    if (info->when)
+    {
+        sch_add_condition (_parms, new_xpath, info->when);
+        DEBUG ("when_clause <%s - %s>\n", new_xpath, info->when);
+    }
+
+    if (info->must)
     {
-        _parms->conditions = g_list_append (_parms->conditions, g_strdup (new_xpath));
-        _parms->conditions = g_list_append (_parms->conditions,
-                                                 g_strdup_printf ("if-feature(%s)", (char *) if_feature));
-        DEBUG("if_feature <%s - %s>\n", new_xpath, if_feature);
-        xmlFree (if_feature);
+        sch_add_condition (_parms, new_xpath, info->must);
+        DEBUG ("must_clause <%s - %s>\n", new_xpath, info->must);
+    }
+
+    if (info->if_feature)
+    {
+        sch_add_condition (_parms, new_xpath, info->if_feature);
+        DEBUG("if_feature <%s - %s>\n", new_xpath, info->if_feature);
     }
 }
 
@@ -177,6 +456,7 @@ _sch_gnode_to_xml (sch_instance * instance, sch_node * schema, sch_ns *ns, xmlNo
     char *name;
     char *condition = NULL;
     char *path = NULL;
+    sch_node_info *info;
 
     /* Get the actual node name */
     if (depth == 0 && strlen (APTERYX_NAME (node)) == 1)
@@ -257,7 +537,8 @@ _sch_gnode_to_xml (sch_instance * instance, sch_node * schema, sch_ns *ns, xmlNo
         free (name);
         return NULL;
     }
-    if (!sch_is_readable (schema))
+    info = sch_node_info_get (schema);
+    if (!info->readable)
     {
         DEBUG ("Ignoring non-readable node %s%s%s\n",
                ns ? sch_ns_prefix (instance, ns) : "", ns ? ":" : "", name);
@@ -265,8 +546,10 @@ _sch_gnode_to_xml (sch_instance * instance, sch_node * schema, sch_ns *ns, xmlNo
         return NULL;
     }
 
+    /* Only nodes with a condition need checking */
     flags |= SCH_F_CONDITIONS;
-    sch_check_condition (schema, node, flags, &path, &condition);
+    if (info->when || info->must || info->if_feature)
+        sch_check_condition (schema, node, flags, &path, &condition);
     if (condition)
     {
         if (!sch_process_condition (netconf_get_g_schema (), node, path, condition))
@@ -395,12 +678,14 @@ _sch_gnode_to_xml (sch_instance * instance, sch_node * schema, sch_ns *ns, xmlNo
                 has_child = true;
             }
         }
-        /* Add this node if we found children or its an empty presence container */
-        if (parent && (has_child || !((xmlNode *)schema)->children))
+        /* Add this node if we found children or its an empty presence container.
+         * A node with no children at all is a container at the max-depth
+         * limit, returned without its contents */
+        if (parent && (has_child || !node->children || !((xmlNode *)schema)->children))
         {
             xmlAddChild (parent, data);
         }
-        else if (!has_child)
+        else if (!has_child && (parent || node->children))
         {
             xmlFreeNode (data);
             data = NULL;
@@ -408,28 +693,19 @@ _sch_gnode_to_xml (sch_instance * instance, sch_node * schema, sch_ns *ns, xmlNo
     }
     else if (APTERYX_HAS_VALUE (node))
     {
-        if (!(flags & SCH_F_CONFIG) || sch_is_writable (schema))
+        if (!(flags & SCH_F_CONFIG) || info->writable)
         {
             char *value = g_strdup (APTERYX_VALUE (node) ? APTERYX_VALUE (node) : "");
-            xmlChar *idref_href;
-            xmlChar *idref_prefix;
 
             data = xmlNewNode (NULL, BAD_CAST name);
             value = sch_translate_to (schema, value);
-            idref_href = xmlGetProp ((xmlNode *) schema, BAD_CAST "idref_href");
-            if (idref_href)
+            if (info->idref_href && info->idref_prefix)
             {
                 char *temp = value;
-                idref_prefix = xmlGetProp ((xmlNode *) schema, BAD_CAST "idref_prefix");
-                if (idref_prefix)
-                {
-                    value = g_strdup_printf ("%s:%s", (char *) idref_prefix, value);
-                    xmlNs *nns = xmlNewNs (data, idref_href, NULL);
-                    xmlSetNs (data, nns);
-                    g_free (temp);
-                    xmlFree (idref_prefix);
-                }
-                xmlFree (idref_href);
+                value = g_strdup_printf ("%s:%s", info->idref_prefix, value);
+                xmlNs *nns = xmlNewNs (data, BAD_CAST info->idref_href, NULL);
+                xmlSetNs (data, nns);
+                g_free (temp);
             }
 
             xmlAddChild (data, xmlNewText ((const xmlChar *) value));
@@ -480,13 +756,41 @@ sch_gnode_to_xml (sch_instance * instance, sch_node * schema, GNode * node, int
         return _sch_gnode_to_xml (instance, schema, NULL, NULL, node, flags, 0);
 }
 
+/* Same answer as checking xmlNodeGetContent for an empty string, without
+ * building the content. Called several times for every node of an edit */
 static bool
 xml_node_has_content (xmlNode * xml)
 {
-    char *content = (char *) xmlNodeGetContent (xml);
-    bool ret = (content && strlen (content) > 0);
-    free (content);
-    return ret;
+    xmlNode *iter;
+
+    for (iter = xml->children; iter; iter = iter->next)
+    {
+        switch (iter->type)
+        {
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+            if (iter->content && iter->content[0] != '\0')
+                return true;
+            break;
+        case XML_ELEMENT_NODE:
+            if (xml_node_has_content (iter))
+                return true;
+            break;
+        case XML_ENTITY_REF_NODE:
+        {
+            /* Rare enough to just expand */
+            char *content = (char *) xmlNodeGetContent (iter);
+            bool ret = (content && content[0] != '\0');
+            free (content);
+            if (ret)
+                return true;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return false;
 }
 
 /**
@@ -494,7 +798,7 @@ xml_node_has_content (xmlNode * xml)
  * operation is recognised or not.
  */
 static bool
-_operation_ok (_sch_xml_to_gnode_parms *_parms, xmlNode *xml, char *curr_op, char **new_op)
+_operation_ok (_sch_xml_to_gnode_parms *_parms, xmlNode *xml, nc_operation curr_op, nc_operation *new_op)
 {
     char *attr;
 
@@ -514,23 +818,23 @@ _operation_ok (_sch_xml_to_gnode_parms *_parms, xmlNode *xml, char *curr_op, cha
         /* Find new attribute. */
         if (g_strcmp0 (attr, "delete") == 0)
         {
-            *new_op = "delete";
+            *new_op = NC_OP_DELETE;
         }
         else if (g_strcmp0 (attr, "merge") == 0)
         {
-            *new_op = "merge";
+            *new_op = NC_OP_MERGE;
         }
         else if (g_strcmp0 (attr, "replace") == 0)
         {
-            *new_op = "replace";
+            *new_op = NC_OP_REPLACE;
         }
         else if (g_strcmp0 (attr, "create") == 0)
         {
-            *new_op = "create";
+            *new_op = NC_OP_CREATE;
         }
         else if (g_strcmp0 (attr, "remove") == 0)
         {
-            *new_op = "remove";
+            *new_op = NC_OP_REMOVE;
         }
         else
         {
@@ -545,8 +849,7 @@ _operation_ok (_sch_xml_to_gnode_parms *_parms, xmlNode *xml, char *curr_op, cha
         /* Check for invalid transitions between sub-operations. We only allow
          * merge->anything transitions.
          */
-        if (g_strcmp0 (curr_op, *new_op) != 0 && g_strcmp0 (curr_op, "merge") != 0 &&
-            g_strcmp0 (curr_op, "none") != 0)
+        if (curr_op != *new_op && curr_op != NC_OP_MERGE && curr_op != NC_OP_NONE)
         {
             _parms->out_error.tag = NC_ERR_TAG_OPR_NOT_SUPPORTED;
             _parms->out_error.type = NC_ERR_TYPE_PROTOCOL;
@@ -557,34 +860,36 @@ _operation_ok (_sch_xml_to_gnode_parms *_parms, xmlNode *xml, char *curr_op, cha
 }
 
 static void
-_perform_actions (_sch_xml_to_gnode_parms *_parms, int depth, char *curr_op, char *new_op, char *new_xpath)
+_perform_actions (_sch_xml_to_gnode_parms *_parms, int depth, nc_operation curr_op, nc_operation new_op,
+                  char *new_xpath)
 {
     /* Do nothing if not an edit, or operation not changing, unless depth is 0. */
-    if (!_parms->in_is_edit || (g_strcmp0 (curr_op, new_op) == 0 && depth != 0))
+    if (!_parms->in_is_edit || (curr_op == new_op && depth != 0))
     {
         return;
     }
 
     /* Handle operations. */
-    if (g_strcmp0 (new_op, "delete") == 0)
+    switch (new_op)
     {
-        _parms->out_deletes = g_list_append (_parms->out_deletes, g_strdup (new_xpath));
+    case NC_OP_DELETE:
+        g_queue_push_tail (&_parms->out_deletes, g_string_chunk_insert (_parms->arena, new_xpath));
         DEBUG ("delete <%s>\n", new_xpath);
-    }
-    else if (g_strcmp0 (new_op, "remove") == 0)
-    {
-        _parms->out_removes = g_list_append (_parms->out_removes, g_strdup (new_xpath));
+        break;
+    case NC_OP_REMOVE:
+        g_queue_push_tail (&_parms->out_removes, g_string_chunk_insert (_parms->arena, new_xpath));
         DEBUG ("remove <%s>\n", new_xpath);
-    }
-    else if (g_strcmp0 (new_op, "create") == 0)
-    {
-        _parms->out_creates = g_list_append (_parms->out_creates, g_strdup (new_xpath));
+        break;
+    case NC_OP_CREATE:
+        g_queue_push_tail (&_parms->out_creates, g_string_chunk_insert (_parms->arena, new_xpath));
         DEBUG ("create <%s>\n", new_xpath);
-    }
-    else if (g_strcmp0 (new_op, "replace") == 0)
-    {
-        _parms->out_replaces = g_list_append (_parms->out_replaces, g_strdup (new_xpath));
+        break;
+    case NC_OP_REPLACE:
+        g_queue_push_tail (&_parms->out_replaces, g_string_chunk_insert (_parms->arena, new_xpath));
         DEBUG ("replace <%s>\n", new_xpath);
+        break;
+    default:
+        break;
     }
 }
 
@@ -603,9 +908,234 @@ _xml_to_gnode_find_key (xmlNode * xml, char * key)
     return NULL;
 }
 
+static _sch_xml_to_gnode_parms *sch_parms_init (sch_instance * instance, int flags,
+                                                 nc_operation def_op, bool is_edit);
+static GNode *_sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *ns,
+                                 GString * xpath, nc_operation curr_op, GNode * pparent,
+                                 xmlNode * xml, int depth, sch_node **rschema);
+
+/* Decode one sibling subtree on a pool thread into its own parms */
+static void
+sch_decode_job_run (gpointer data, gpointer user_data)
+{
+    sch_decode_job *job = (sch_decode_job *) data;
+    GString *xpath = g_string_new (job->xpath);
+
+    job->tree = _sch_xml_to_gnode (job->parms, job->schema, job->ns, xpath, job->op, NULL,
+                                   job->xml, job->depth, NULL);
+    g_string_free (xpath, TRUE);
+
+    g_mutex_lock (&job->batch->lock);
+    if (--job->batch->pending == 0)
+        g_cond_signal (&job->batch->cond);
+    g_mutex_unlock (&job->batch->lock);
+}
+
+/* Move every entry of one queue onto the end of another */
+static void
+sch_queue_move (GQueue *to, GQueue *from)
+{
+    if (g_queue_is_empty (from))
+        return;
+    if (g_queue_is_empty (to))
+    {
+        *to = *from;
+    }
+    else
+    {
+        to->tail->next = from->head;
+        from->head->prev = to->tail;
+        to->tail = from->tail;
+        to->length += from->length;
+    }
+    g_queue_init (from);
+}
+
+/* Fold a sibling's results into the parent parms, keeping document order */
+static void
+sch_decode_job_merge (_sch_xml_to_gnode_parms *_parms, _sch_xml_to_gnode_parms *wparms)
+{
+    GList *iter;
+
+    sch_queue_move (&_parms->out_deletes, &wparms->out_deletes);
+    sch_queue_move (&_parms->out_removes, &wparms->out_removes);
+    sch_queue_move (&_parms->out_creates, &wparms->out_creates);
+    sch_queue_move (&_parms->out_replaces, &wparms->out_replaces);
+    sch_queue_move (&_parms->out_merges, &wparms->out_merges);
+    sch_queue_move (&_parms->out_errors, &wparms->out_errors);
+
+    /* Conditions are still only checked once per path */
+    g_hash_table_remove_all (wparms->condition_set);
+    for (iter = wparms->conditions.head; iter; iter = iter->next)
+    {
+        sch_condition *cond = iter->data;
+        if (g_hash_table_contains (_parms->condition_set, cond))
+        {
+            sch_condition_free (cond);
+            continue;
+        }
+        g_queue_push_tail (&_parms->conditions, cond);
+        g_hash_table_add (_parms->condition_set, cond);
+    }
+    g_list_free (wparms->conditions.head);
+    g_queue_init (&wparms->conditions);
+
+    /* The paths moved over are still in the sibling's arena */
+    _parms->arenas = g_list_concat (wparms->arenas, _parms->arenas);
+    _parms->arenas = g_list_prepend (_parms->arenas, wparms->arena);
+    wparms->arenas = NULL;
+    wparms->arena = NULL;
+}
+
+/* Keep the error from an element that failed so its siblings can carry on */
+static void
+sch_skip_error (_sch_xml_to_gnode_parms *_parms, nc_error_parms *error, const char *path,
+                const char *name)
+{
+    nc_error_parms *skipped = g_malloc (sizeof (*skipped));
+
+    *skipped = *error;
+    *error = NC_ERROR_PARMS_INIT;
+    g_hash_table_insert (skipped->info, "error-path", g_strdup_printf ("%s/%s", path, name));
+    g_queue_push_tail (&_parms->out_errors, skipped);
+}
+
+/* Queue lengths before decoding an element, so a failure can be undone */
+typedef struct _sch_parms_mark
+{
+    guint deletes;
+    guint removes;
+    guint creates;
+    guint replaces;
+    guint merges;
+    guint conditions;
+} sch_parms_mark;
+
+static void
+sch_parms_mark_set (_sch_xml_to_gnode_parms *_parms, sch_parms_mark *mark)
+{
+    mark->deletes = _parms->out_deletes.length;
+    mark->removes = _parms->out_removes.length;
+    mark->creates = _parms->out_creates.length;
+    mark->replaces = _parms->out_replaces.length;
+    mark->merges = _parms->out_merges.length;
+    mark->conditions = _parms->conditions.length;
+}
+
+/* The paths stay in the arena until the parms are freed */
+static void
+sch_queue_truncate (GQueue *queue, guint length)
+{
+    while (queue->length > length)
+        g_queue_pop_tail (queue);
+}
+
+/* Drop everything an element that failed added to the parms */
+static void
+sch_parms_rollback (_sch_xml_to_gnode_parms *_parms, sch_parms_mark *mark)
+{
+    sch_queue_truncate (&_parms->out_deletes, mark->deletes);
+    sch_queue_truncate (&_parms->out_removes, mark->removes);
+    sch_queue_truncate (&_parms->out_creates, mark->creates);
+    sch_queue_truncate (&_parms->out_replaces, mark->replaces);
+    sch_queue_truncate (&_parms->out_merges, mark->merges);
+    while (_parms->conditions.length > mark->conditions)
+    {
+        sch_condition *cond = g_queue_pop_tail (&_parms->conditions);
+        g_hash_table_remove (_parms->condition_set, cond);
+        sch_condition_free (cond);
+    }
+}
+
+/* Decode the children of an edit node across the pool. Returns false with
+ * the error of the first failing child, in document order, in the parms */
+static bool
+sch_decode_children (_sch_xml_to_gnode_parms *_parms, sch_node *schema, sch_ns *ns,
+                     GString *xpath, nc_operation curr_op, xmlNode *xml, int depth,
+                     GNode **tree, GNode *node, bool *ret_tree)
+{
+    sch_decode_batch batch;
+    sch_decode_job *jobs;
+    xmlNode *child;
+    int count = xmlChildElementCount (xml);
+    int i = 0;
+    bool ok = true;
+
+    DEBUG ("Decoding %d siblings of %s on the pool\n", count, xpath->str);
+    g_mutex_init (&batch.lock);
+    g_cond_init (&batch.cond);
+    batch.pending = count;
+    jobs = g_new0 (sch_decode_job, count);
+    for (child = xmlFirstElementChild (xml); child; child = xmlNextElementSibling (child), i++)
+    {
+        sch_decode_job *job = &jobs[i];
+
+        job->parms = sch_parms_init (_parms->in_instance, _parms->in_flags,
+                                     _parms->in_def_op, _parms->in_is_edit);
+        job->parms->in_worker = true;
+        job->parms->in_continue = _parms->in_continue;
+        job->schema = schema;
+        job->ns = ns;
+        job->xpath = xpath->str;
+        job->op = curr_op;
+        job->xml = child;
+        job->depth = depth;
+        job->batch = &batch;
+        g_thread_pool_push (sch_decode_pool, job, NULL);
+    }
+
+    g_mutex_lock (&batch.lock);
+    while (batch.pending)
+        g_cond_wait (&batch.cond, &batch.lock);
+    g_mutex_unlock (&batch.lock);
+
+    for (i = 0; i < count; i++)
+    {
+        sch_decode_job *job = &jobs[i];
+
+        if (job->parms->out_error.tag && _parms->in_continue)
+        {
+            /* Only this sibling is left out */
+            sch_queue_move (&_parms->out_errors, &job->parms->out_errors);
+            sch_skip_error (_parms, &job->parms->out_error, xpath->str, (const char *) job->xml->name);
+            apteryx_free_tree (job->tree);
+            sch_parm_free (job->parms);
+            continue;
+        }
+        if (ok && job->parms->out_error.tag)
+        {
+            nc_error_parms error = _parms->out_error;
+            _parms->out_error = job->parms->out_error;
+            job->parms->out_error = error;
+            ok = false;
+        }
+        if (ok)
+        {
+            sch_decode_job_merge (_parms, job->parms);
+            if (job->tree)
+            {
+                if (node)
+                    g_node_append (node, job->tree);
+                else
+                    *tree = job->tree;
+                *ret_tree = true;
+            }
+        }
+        else if (job->tree)
+        {
+            apteryx_free_tree (job->tree);
+        }
+        sch_parm_free (job->parms);
+    }
+    g_free (jobs);
+    g_cond_clear (&batch.cond);
+    g_mutex_clear (&batch.lock);
+    return ok;
+}
+
 static GNode *
-_sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *ns, char * part_xpath,
-                   char * curr_op, GNode * pparent, xmlNode * xml, int depth, sch_node **rschema)
+_sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *ns, GString * xpath,
+                   nc_operation curr_op, GNode * pparent, xmlNode * xml, int depth, sch_node **rschema)
 {
     sch_instance *instance = _parms->in_instance;
     int flags = _parms->in_flags;
@@ -615,8 +1145,8 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
     GNode *tree = NULL;
     GNode *node = NULL;
     char *key = NULL;
-    char *new_xpath = NULL;
-    char *new_op = curr_op;
+    gsize xpath_len = xpath->len;
+    nc_operation new_op = curr_op;
     bool key_valid = false;
     bool ret_tree = false;
     bool is_proxy = false;
@@ -678,14 +1208,15 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
     else
         name = g_strdup ((char *) xml->name);
 
-    /* Update xpath. */
-    new_xpath = g_strdup_printf ("%s/%s", part_xpath, name);
+    /* Update xpath, shared by the whole walk and put back on exit */
+    g_string_append_c (xpath, '/');
+    g_string_append (xpath, name);
 
     /* Check operation, error tag set on exit from routine. */
     if (!_operation_ok (_parms, xml, curr_op, &new_op))
     {
         DEBUG ("Invalid operation\n");
-        free (new_xpath);
+        g_string_truncate (xpath, xpath_len);
         free (name);
         return NULL;
     }
@@ -693,7 +1224,6 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
     /* LIST */
     if (sch_is_leaf_list (schema))
     {
-        char *old_xpath = new_xpath;
         sch_node *parent = schema;
 
         DEBUG ("%*s%s%s\n", depth * 2, " ", depth ? "" : "/", name);
@@ -703,7 +1233,7 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
         if (xml_node_has_content (xml))
         {
             if (_parms->in_is_edit)
-                sch_check_condition_parms (_parms, parent, new_xpath);
+                sch_check_condition_parms (_parms, parent, xpath->str);
 
             char *content = (char *) xmlNodeGetContent (xml);
             if (_parms->in_is_edit && !sch_validate_pattern (schema, content))
@@ -720,40 +1250,38 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
                 goto exit;
             }
 
-            char *key_value = _sch_key_encode (content);
-            if (g_strcmp0 (new_op, "delete") == 0 || g_strcmp0 (new_op, "remove") == 0 ||
-                g_strcmp0 (new_op, "none") == 0)
+            /* Encode the key straight onto the path rather than a copy */
+            g_string_append_c (xpath, '/');
+            gsize key_offset = xpath->len;
+            _sch_key_encode_append (xpath, content);
+            if (new_op == NC_OP_DELETE || new_op == NC_OP_REMOVE || new_op == NC_OP_NONE)
             {
-                new_xpath = g_strdup_printf ("%s/%s", old_xpath, key_value);
                 apteryx_free_tree (tree);
                 tree = NULL;
+                g_free (content);
             }
             else
             {
-                new_xpath = g_strdup_printf ("%s/%s", old_xpath, key_value);
-                node = APTERYX_NODE (tree, g_strdup (key_value));
-                node = APTERYX_NODE (node, g_strdup (content));
+                node = APTERYX_NODE (tree, g_strdup (xpath->str + key_offset));
+                node = APTERYX_NODE (node, content);
                 if (_parms->in_is_edit)
                 {
-                    if (g_strcmp0 (new_op, "merge") == 0)
+                    if (new_op == NC_OP_MERGE)
                     {
-                        _parms->out_merges =
-                            g_list_append (_parms->out_merges, g_strdup(new_xpath));
-                        DEBUG ("merge <%s>\n", new_xpath);
+                        g_queue_push_tail (&_parms->out_merges,
+                                           g_string_chunk_insert (_parms->arena, xpath->str));
+                        DEBUG ("merge <%s>\n", xpath->str);
 
                     }
-                    else if (g_strcmp0 (new_op, "replace") == 0)
+                    else if (new_op == NC_OP_REPLACE)
                     {
-                        _parms->out_replaces =
-                            g_list_append (_parms->out_replaces, g_strdup(new_xpath));
-                        DEBUG ("replace <%s>\n", new_xpath);
+                        g_queue_push_tail (&_parms->out_replaces,
+                                           g_string_chunk_insert (_parms->arena, xpath->str));
+                        DEBUG ("replace <%s>\n", xpath->str);
 
                     }
                 }
             }
-            g_free (content);
-            g_free (key_value);
-            g_free (old_xpath);
             ret_tree = true;
         }
         else
@@ -766,7 +1294,6 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
     }
     else if (sch_is_list (schema))
     {
-        char *old_xpath = new_xpath;
         char *key_value;
 
         key = sch_name (sch_node_child_first (sch_node_child_first (schema)));
@@ -819,14 +1346,14 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
         }
 
         if (_parms->in_is_edit)
-            sch_check_condition_parms (_parms, schema, new_xpath);
+            sch_check_condition_parms (_parms, schema, xpath->str);
 
         schema = sch_node_child_first (schema);
         if (rschema)
             *rschema = schema;
 
-        new_xpath = g_strdup_printf ("%s/%s", old_xpath, key_value);
-        g_free (old_xpath);
+        g_string_append_c (xpath, '/');
+        g_string_append (xpath, key_value);
     }
     /* CONTAINER */
     else if (!sch_is_leaf (schema))
@@ -834,13 +1361,13 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
         DEBUG ("%*s%s%s\n", depth * 2, " ", depth ? "" : "/", name);
         tree = node = APTERYX_NODE (NULL, g_strdup_printf ("%s%s", depth ? "" : "/", name));
         if (_parms->in_is_edit)
-            sch_check_condition_parms (_parms, schema, new_xpath);
+            sch_check_condition_parms (_parms, schema, xpath->str);
     }
     /* LEAF */
     else
     {
         /* Check that this leaf is writable */
-        if (_parms->in_is_edit && !sch_is_writable (schema))
+        if (_parms->in_is_edit && !sch_node_info_get (schema)->writable)
         {
             DEBUG ("Attempt to edit non-writable node \"%s\"\n", name);
             apteryx_free_tree (tree);
@@ -850,21 +1377,21 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
             goto exit;
         }
 
-        if (g_strcmp0 (new_op, "delete") != 0 && g_strcmp0 (new_op, "remove") != 0 &&
-            g_strcmp0 (new_op, "none") != 0)
+        if (new_op != NC_OP_DELETE && new_op != NC_OP_REMOVE && new_op != NC_OP_NONE)
         {
             sch_node *sch_parent;
             gboolean validate = true;
+            bool has_content = xml_node_has_content (xml);
             char *value = NULL;
 
             tree = node = APTERYX_NODE (NULL, g_strdup (name));
             ret_tree = true;
-            if (!xml_node_has_content (xml) && !(_parms->in_flags & SCH_F_STRIP_DATA)
+            if (!has_content && !(_parms->in_flags & SCH_F_STRIP_DATA)
                     && (_parms->in_is_edit))
             {
                 value = g_strdup ("");
             }
-            else if (xml_node_has_content (xml) && !(_parms->in_flags & SCH_F_STRIP_DATA))
+            else if (has_content && !(_parms->in_flags & SCH_F_STRIP_DATA))
             {
                 value = (char *) xmlNodeGetContent (xml);
                 value = sch_translate_from (schema, value);
@@ -893,7 +1420,7 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
                 }
 
                 if (_parms->in_is_edit)
-                    sch_check_condition_parms (_parms, schema, new_xpath);
+                    sch_check_condition_parms (_parms, schema, xpath->str);
 
                 /* Test for RFC6241 section 6.2.5 compliance */
                 sch_parent = sch_node_parent (sch_node_parent (schema));
@@ -929,18 +1456,18 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
                     DEBUG ("%*s%s = %s\n", depth * 2, " ", name, APTERYX_NAME (node));
                     if (_parms->in_is_edit)
                     {
-                        if (g_strcmp0 (new_op, "merge") == 0)
+                        if (new_op == NC_OP_MERGE)
                         {
-                            _parms->out_merges =
-                                g_list_append (_parms->out_merges, g_strdup(new_xpath));
-                            DEBUG ("merge <%s>\n", new_xpath);
+                            g_queue_push_tail (&_parms->out_merges,
+                                               g_string_chunk_insert (_parms->arena, xpath->str));
+                            DEBUG ("merge <%s>\n", xpath->str);
 
                         }
-                        else if (g_strcmp0 (new_op, "replace") == 0)
+                        else if (new_op == NC_OP_REPLACE)
                         {
-                            _parms->out_replaces =
-                                g_list_append (_parms->out_replaces, g_strdup(new_xpath));
-                            DEBUG ("replace <%s>\n", new_xpath);
+                            g_queue_push_tail (&_parms->out_replaces,
+                                               g_string_chunk_insert (_parms->arena, xpath->str));
+                            DEBUG ("replace <%s>\n", xpath->str);
 
                         }
                     }
@@ -952,7 +1479,23 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
     }
 
     /* Carry out actions for this operation. Does nothing if not edit-config. */
-    _perform_actions (_parms, depth, curr_op, new_op, new_xpath);
+    _perform_actions (_parms, depth, curr_op, new_op, xpath->str);
+
+    /* Bulk edits decode independent siblings in parallel */
+    if (sch_decode_pool && _parms->in_is_edit && !_parms->in_worker && !rschema &&
+        !(_parms->in_flags & SCH_F_STRIP_KEY) &&
+        xmlChildElementCount (xml) >= SCH_PARALLEL_MIN_CHILDREN)
+    {
+        if (!sch_decode_children (_parms, schema, ns, xpath, new_op, xml, depth + 1,
+                                  &tree, node, &ret_tree))
+        {
+            apteryx_free_tree (tree);
+            tree = NULL;
+            DEBUG ("parallel decode failed: depth=%d\n", depth);
+            goto exit;
+        }
+        goto children_done;
+    }
 
     for (child = xmlFirstElementChild (xml); child; child = xmlNextElementSibling (child))
     {
@@ -998,7 +1541,20 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
         }
         else
         {
-            GNode *cn = _sch_xml_to_gnode (_parms, schema, ns, new_xpath, new_op, NULL, child, depth + 1, rschema);
+            sch_parms_mark mark;
+
+            if (_parms->in_continue)
+                sch_parms_mark_set (_parms, &mark);
+            GNode *cn = _sch_xml_to_gnode (_parms, schema, ns, xpath, new_op, NULL, child, depth + 1, rschema);
+            if (_parms->out_error.tag && _parms->in_continue)
+            {
+                /* Leave out just this child and carry on with the rest */
+                DEBUG ("skipping failed child: depth=%d\n", depth);
+                sch_parms_rollback (_parms, &mark);
+                sch_skip_error (_parms, &_parms->out_error, xpath->str, (const char *) child->name);
+                apteryx_free_tree (cn);
+                continue;
+            }
             if (_parms->out_error.tag)
             {
                 apteryx_free_tree (tree);
@@ -1017,6 +1573,7 @@ _sch_xml_to_gnode (_sch_xml_to_gnode_parms *_parms, sch_node * schema, sch_ns *n
         }
     }
 
+children_done:
     /* If no children added, no point in returning anything. */
     if (!ret_tree && _parms->in_is_edit)
     {
@@ -1041,14 +1598,14 @@ exit:
     free (key);
     if (!tree)
     {
-        DEBUG ("returning NULL: xpath=%s\n", new_xpath);
+        DEBUG ("returning NULL: xpath=%s\n", xpath->str);
     }
-    g_free (new_xpath);
+    g_string_truncate (xpath, xpath_len);
     return tree;
 }
 
 static _sch_xml_to_gnode_parms *
-sch_parms_init (sch_instance * instance, int flags, char * def_op, bool is_edit)
+sch_parms_init (sch_instance * instance, int flags, nc_operation def_op, bool is_edit)
 {
     _sch_xml_to_gnode_parms *_parms = g_malloc (sizeof (*_parms));
     _parms->in_instance = instance;
@@ -1057,24 +1614,48 @@ sch_parms_init (sch_instance * instance, int flags, char * def_op, bool is_edit)
     _parms->in_is_edit = is_edit;
     _parms->out_tree = NULL;
     _parms->out_error = NC_ERROR_PARMS_INIT;
-    _parms->out_deletes = NULL;
-    _parms->out_removes = NULL;
-    _parms->out_creates = NULL;
-    _parms->out_replaces = NULL;
-    _parms->out_merges = NULL;
-    _parms->conditions = NULL;
+    g_queue_init (&_parms->out_deletes);
+    g_queue_init (&_parms->out_removes);
+    g_queue_init (&_parms->out_creates);
+    g_queue_init (&_parms->out_replaces);
+    g_queue_init (&_parms->out_merges);
+    g_queue_init (&_parms->conditions);
+    _parms->condition_set = g_hash_table_new (sch_condition_hash, sch_condition_equal);
+    _parms->in_worker = false;
+    _parms->in_continue = false;
+    g_queue_init (&_parms->out_errors);
+    _parms->arena = is_edit ? g_string_chunk_new (4096) : NULL;
+    _parms->arenas = NULL;
     return _parms;
 }
 
+/* Size the pool used to decode large edits, zero to decode inline */
+void
+sch_set_decode_threads (int threads)
+{
+    if (sch_decode_pool)
+    {
+        g_thread_pool_free (sch_decode_pool, FALSE, TRUE);
+        sch_decode_pool = NULL;
+    }
+    if (threads > 0)
+        sch_decode_pool = g_thread_pool_new (sch_decode_job_run, NULL, threads, FALSE, NULL);
+}
+
 sch_xml_to_gnode_parms
 sch_xml_to_gnode (sch_instance * instance, sch_node * schema, xmlNode * xml, int flags,
-                  char * def_op, bool is_edit, sch_node **rschema)
+                  nc_operation def_op, bool is_edit, bool continue_on_error, sch_node **rschema)
 {
     _sch_xml_to_gnode_parms *_parms = sch_parms_init(instance, flags, def_op, is_edit);
 
+    _parms->in_continue = is_edit && continue_on_error;
     if (xml)
-        _parms->out_tree = _sch_xml_to_gnode (_parms, schema, NULL, "", def_op, NULL, xml, 0,
+    {
+        GString *xpath = g_string_sized_new (256);
+        _parms->out_tree = _sch_xml_to_gnode (_parms, schema, NULL, xpath, def_op, NULL, xml, 0,
                                               rschema);
+        g_string_free (xpath, TRUE);
+    }
     else
     {
         _parms->out_error.tag = NC_ERR_TAG_INVALID_VAL;
@@ -1114,7 +1695,7 @@ sch_parm_deletes (sch_xml_to_gnode_parms parms)
     {
         return NULL;
     }
-    return _parms->out_deletes;
+    return _parms->out_deletes.head;
 }
 
 GList *
@@ -1126,7 +1707,7 @@ sch_parm_removes (sch_xml_to_gnode_parms parms)
     {
         return NULL;
     }
-    return _parms->out_removes;
+    return _parms->out_removes.head;
 }
 
 GList *
@@ -1138,7 +1719,7 @@ sch_parm_creates (sch_xml_to_gnode_parms parms)
     {
         return NULL;
     }
-    return _parms->out_creates;
+    return _parms->out_creates.head;
 }
 
 GList *
@@ -1150,7 +1731,7 @@ sch_parm_replaces (sch_xml_to_gnode_parms parms)
     {
         return NULL;
     }
-    return _parms->out_replaces;
+    return _parms->out_replaces.head;
 }
 
 GList *
@@ -1162,7 +1743,7 @@ sch_parm_merges (sch_xml_to_gnode_parms parms)
     {
         return NULL;
     }
-    return _parms->out_merges;
+    return _parms->out_merges.head;
 }
 
 GList *
@@ -1174,7 +1755,19 @@ sch_parm_conditions (sch_xml_to_gnode_parms parms)
     {
         return NULL;
     }
-    return _parms->conditions;
+    return _parms->conditions.head;
+}
+
+GList *
+sch_parm_errors (sch_xml_to_gnode_parms parms)
+{
+    _sch_xml_to_gnode_parms *_parms = parms;
+
+    if (!_parms)
+    {
+        return NULL;
+    }
+    return _parms->out_errors.head;
 }
 
 bool
@@ -1186,8 +1779,18 @@ sch_parm_need_tree_set (sch_xml_to_gnode_parms parms)
     {
         return false;
     }
-    return _parms->out_replaces || _parms->out_merges ||
-           _parms->out_creates ? true : false;
+    return !g_queue_is_empty (&_parms->out_replaces) || !g_queue_is_empty (&_parms->out_merges) ||
+           !g_queue_is_empty (&_parms->out_creates);
+}
+
+static void
+sch_error_free (gpointer data)
+{
+    nc_error_parms *error = (nc_error_parms *) data;
+
+    g_string_free (error->msg, TRUE);
+    g_hash_table_destroy (error->info);
+    g_free (error);
 }
 
 void
@@ -1197,12 +1800,17 @@ sch_parm_free (sch_xml_to_gnode_parms parms)
 
     if (_parms)
     {
-        g_list_free_full (_parms->out_deletes, g_free);
-        g_list_free_full (_parms->out_removes, g_free);
-        g_list_free_full (_parms->out_creates, g_free);
-        g_list_free_full (_parms->out_replaces, g_free);
-        g_list_free_full (_parms->out_merges, g_free);
-        g_list_free_full (_parms->conditions, g_free);
+        g_list_free (_parms->out_deletes.head);
+        g_list_free (_parms->out_removes.head);
+        g_list_free (_parms->out_creates.head);
+        g_list_free (_parms->out_replaces.head);
+        g_list_free (_parms->out_merges.head);
+        g_hash_table_destroy (_parms->condition_set);
+        g_list_free_full (_parms->conditions.head, sch_condition_free);
+        if (_parms->arena)
+            g_string_chunk_free (_parms->arena);
+        g_list_free_full (_parms->arenas, (GDestroyNotify) g_string_chunk_free);
+        g_list_free_full (_parms->out_errors.head, sch_error_free);
         _parms->out_error.tag = 0;
         _parms->out_error.type = 0;
         g_string_free (_parms->out_error.msg, TRUE);
@@ -37,6 +37,11 @@
 /* Debug */
 extern gboolean apteryx_netconf_debug;
 extern gboolean apteryx_netconf_verbose;
+extern gboolean apteryx_netconf_coalesce;
+extern gboolean apteryx_netconf_journal;
+extern gboolean apteryx_netconf_load_startup;
+extern gint apteryx_netconf_max_request;
+extern gint apteryx_netconf_max_request_memory;
 #define DEBUG(fmt, args...) \
     if (apteryx_netconf_debug || apteryx_netconf_verbose) \
     { \
@@ -98,8 +103,8 @@ extern GMainLoop *g_loop;
 
 /* Netconf routines */
 void netconf_close_open_sessions (void);
-bool netconf_init (const char *path, const char *supported,
-                   const char *cp, const char *rm);
+bool netconf_init (const char *path, const char *supported, const char *startup,
+                   const char *export);
 void *netconf_handle_session (int fd);
 void netconf_shutdown (void);
 
@@ -111,6 +116,26 @@ void logging_shutdown (void);
 
 typedef void * sch_xml_to_gnode_parms;
 
+/* Edit-config operations */
+typedef enum
+{
+    NC_OP_NONE,
+    NC_OP_MERGE,
+    NC_OP_REPLACE,
+    NC_OP_CREATE,
+    NC_OP_DELETE,
+    NC_OP_REMOVE,
+} nc_operation;
+
+/* A when, must or if-feature condition for a node in an edit. The path
+ * lives as long as the parms it came from and the expression belongs to the
+ * schema, living until sch_node_info_cache_free */
+typedef struct _sch_condition
+{
+    char *path;
+    char *condition;
+} sch_condition;
+
 /*
  * Netconf error handling
  **/
@@ -179,8 +204,9 @@ typedef void sch_node;
 sch_instance *netconf_get_g_schema (void);
 xmlNode *sch_gnode_to_xml (sch_instance * instance, sch_node * schema, GNode * node, int flags);
 sch_xml_to_gnode_parms sch_xml_to_gnode (sch_instance * instance, sch_node * schema,
-                                         xmlNode * xml, int flags, char * def_op,
-                                         bool is_edit, sch_node **rschema);
+                                         xmlNode * xml, int flags, nc_operation def_op,
+                                         bool is_edit, bool continue_on_error,
+                                         sch_node **rschema);
 GNode *sch_parm_tree (sch_xml_to_gnode_parms parms);
 nc_error_parms sch_parm_error (sch_xml_to_gnode_parms parms);
 GList *sch_parm_deletes (sch_xml_to_gnode_parms parms);
@@ -189,8 +215,16 @@ GList *sch_parm_creates (sch_xml_to_gnode_parms parms);
 GList *sch_parm_replaces (sch_xml_to_gnode_parms parms);
 GList *sch_parm_merges (sch_xml_to_gnode_parms parms);
 GList *sch_parm_conditions (sch_xml_to_gnode_parms parms);
+GList *sch_parm_errors (sch_xml_to_gnode_parms parms);
 bool sch_parm_need_tree_set (sch_xml_to_gnode_parms parms);
 void sch_parm_free (sch_xml_to_gnode_parms parms);
+void sch_node_info_init (sch_instance *instance);
+void sch_node_info_cache_free (void);
+void sch_names_init (sch_instance *instance);
+void sch_names_free (void);
+xmlDict *sch_names_dict (void);
+const xmlChar *sch_node_xml_name (sch_node *node, bool local);
+void sch_set_decode_threads (int threads);
 GNode *sch_xpath_to_gnode (sch_instance * instance, sch_node * schema, const char *path, int flags,
                            sch_node ** rschema, xpath_type *x_type, char *schema_path);
 char *sch_xpath_set_ns_path (sch_instance * instance, sch_node * schema, xmlNode * xml,
@@ -25,13 +25,21 @@
 
 gboolean apteryx_netconf_debug = FALSE;
 gboolean apteryx_netconf_verbose = FALSE;
+gboolean apteryx_netconf_coalesce = FALSE;
+gboolean apteryx_netconf_journal = FALSE;
+gboolean apteryx_netconf_load_startup = FALSE;
+gint apteryx_netconf_max_request = 0;
+gint apteryx_netconf_max_request_memory = 0;
 static gboolean background = FALSE;
 static gchar *models_path = "./";
 static gchar *supported = NULL;
 static gchar *logging_arg = NULL;
 static gchar *unix_path = "/tmp/apteryx-netconf";
+static gchar *startup_path = NULL;
 static gchar *cp_cmd = NULL;
 static gchar *rm_cmd = NULL;
+static gchar *export_path = NULL;
+static gint decode_threads = 0;
 static GThread *g_thread = NULL;
 GMainLoop *g_loop = NULL;
 static int accept_fd = -1;
@@ -101,10 +109,26 @@ static GOptionEntry entries[] = {
      "Name of a file containing a list of events to log", NULL},
     {"unix", 'u', 0, G_OPTION_ARG_STRING, &unix_path,
      "Listen on unix socket (defaults to /tmp/apteryx-netconf.sock)", NULL},
+    {"startup", 'f', 0, G_OPTION_ARG_STRING, &startup_path,
+     "File holding the startup datastore (defaults to none)", NULL},
     {"copy", 'c', 0, G_OPTION_ARG_STRING, &cp_cmd,
-     "BASH command to run to copy running->startup", NULL},
+     "Deprecated and ignored, use --startup", NULL},
     {"remove", 'r', 0, G_OPTION_ARG_STRING, &rm_cmd,
-     "BASH command to run to remove startup config", NULL},
+     "Deprecated and ignored, use --startup", NULL},
+    {"journal", 'j', 0, G_OPTION_ARG_NONE, &apteryx_netconf_journal,
+     "Save startup as a journal of changes on top of the last full copy", NULL},
+    {"load-startup", 'o', 0, G_OPTION_ARG_NONE, &apteryx_netconf_load_startup,
+     "Apply the startup datastore to running when started", NULL},
+    {"export", 'x', 0, G_OPTION_ARG_STRING, &export_path,
+     "Directory for config files exported or restored by copy-config (defaults to none)", NULL},
+    {"coalesce", 'e', 0, G_OPTION_ARG_NONE, &apteryx_netconf_coalesce,
+     "Apply back-to-back edits from a session together", NULL},
+    {"decode-threads", 't', 0, G_OPTION_ARG_INT, &decode_threads,
+     "Threads used to decode large edit-config requests (defaults to 0, disabled)", NULL},
+    {"max-request-size", 'z', 0, G_OPTION_ARG_INT, &apteryx_netconf_max_request,
+     "Largest request a session may send in bytes (defaults to 32768)", NULL},
+    {"max-request-memory", 'g', 0, G_OPTION_ARG_INT, &apteryx_netconf_max_request_memory,
+     "Bytes of requests all sessions may be receiving at once (defaults to 16777216)", NULL},
     {NULL}
 };
 
@@ -134,10 +158,11 @@ main (int argc, char *argv[])
 
     /* Initialization */
     apteryx_init (apteryx_netconf_verbose);
-    if (!netconf_init (models_path, supported, cp_cmd, rm_cmd))
+    if (!netconf_init (models_path, supported, startup_path, export_path))
     {
         g_error ("Failed to load models from \"%s\"\n", models_path);
     }
+    sch_set_decode_threads (decode_threads);
 
     /* Initialize logging */
     if (logging_arg)
@@ -168,6 +193,7 @@ main (int argc, char *argv[])
     unlink (unix_path);
 
     /* Shutdown */
+    sch_set_decode_threads (0);
     netconf_shutdown ();
     apteryx_shutdown ();
     xmlCleanupParser ();
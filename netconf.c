@@ -20,12 +20,18 @@
 #include "internal.h"
 #define __USE_GNU
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <pwd.h>
 #define APTERYX_XML_LIBXML2
 #include <apteryx-xml.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/debugXML.h>
+#include <libxml/xmlreader.h>
 
 #define DEFAULT_LANG "en"
 #define RECV_TIMEOUT_SEC 60
@@ -42,13 +48,49 @@ struct netconf_session
     gchar *login_time;
     bool running;
     session_counters_t counters;
+    /* Edits held back to be applied together, and the requests to reply to */
+    GNode *pending_edit;
+    GList *pending_rpcs;
+    /* Client is on this host rather than at the end of an SSH connection */
+    bool local;
+    /* Descriptor passed with the current request, -1 if none */
+    int passed_fd;
+    /* Bytes of the global request memory held by the current request */
+    uint64_t request_memory;
+    /* Parser kept between messages, and the size of its dictionary when new */
+    xmlParserCtxt *parser;
+    int parser_names;
 };
 
-static struct _running_ds_lock_t
+struct ds_lock
 {
     struct netconf_session nc_sess;
     gboolean locked;
-} running_ds_lock;
+};
+static struct ds_lock running_ds_lock;
+static struct ds_lock candidate_ds_lock;
+static struct ds_lock startup_ds_lock;
+
+typedef enum
+{
+    NC_DS_RUNNING,
+    NC_DS_CANDIDATE,
+    NC_DS_STARTUP,
+} nc_datastore;
+
+typedef enum
+{
+    NC_TEST_THEN_SET,
+    NC_TEST_SET,
+    NC_TEST_ONLY,
+} nc_test_option;
+
+typedef enum
+{
+    NC_ERROR_STOP,
+    NC_ERROR_CONTINUE,
+    NC_ERROR_ROLLBACK,
+} nc_error_option;
 
 typedef struct _q_param
 {
@@ -62,22 +104,50 @@ typedef struct _q_param
 #define NETCONF_HELLO_END_LEN 12
 #define HELLO_RX_SIZE 1024
 #define MAX_HELLO_RX_SIZE 16384
-#define MAX_REQUEST_MESSAGE_SIZE 32768
+#define RX_STREAM_SIZE 65536
+#define COALESCE_MAX_EDITS 64
+/* Messages never load anything from the network, and entities are left as
+ * references rather than substituted */
+#define NETCONF_PARSE_OPTIONS XML_PARSE_NONET
+/* Names a session parser may collect before it is replaced */
+#define PARSER_NAMES_MAX 4096
 
 #define NETCONF_STATE_SESSIONS_PATH "/netconf-state/sessions/session"
 #define NETCONF_STATE_STATISTICS_PATH "/netconf-state/statistics"
 #define NETCONF_SESSION_STATUS "/netconf-state/sessions/session/*/status"
 #define NETCONF_CONFIG_MAX_SESSIONS "/netconf/config/max-sessions"
+#define NETCONF_CONFIG_MAX_REQUEST "/netconf/config/max-request-size"
 #define NETCONF_STATE "/netconf/state"
 
+/* get-changes is not part of the base protocol so has its own namespace,
+ * advertised as a capability */
+#define NETCONF_CHANGES_NS "urn:alliedtelesis:params:xml:ns:netconf:get-changes:1.0"
+#define NETCONF_CHANGES_CAPABILITY "urn:alliedtelesis:params:netconf:capability:get-changes:1.0"
+
 /* Defines for the max-sessions variable - the maximum number of sessions allowed */
 #define NETCONF_MAX_SESSIONS_MIN 1
 #define NETCONF_MAX_SESSIONS_MAX 10
 #define NETCONF_MAX_SESSIONS_DEF 4
 
+/* Defines for the max-request-size variable - the largest request a session may send */
+#define NETCONF_MAX_REQUEST_MIN 4096
+#define NETCONF_MAX_REQUEST_MAX (1024 * 1024 * 1024)
+#define NETCONF_MAX_REQUEST_DEF 32768
+
+/* Default for the bytes of requests all sessions may be receiving at once */
+#define NETCONF_REQUEST_MEMORY_DEF (16 * 1024 * 1024)
+
 static uint32_t netconf_session_id = 1;
 static uint32_t netconf_max_sessions = NETCONF_MAX_SESSIONS_DEF;
 static uint32_t netconf_num_sessions = 0;
+static uint32_t netconf_max_request_def = NETCONF_MAX_REQUEST_DEF;
+static uint32_t netconf_max_request = NETCONF_MAX_REQUEST_DEF;
+
+/* Every chunk received counts against the request memory until its request
+ * has been handled, whether it was buffered or streamed into the parser */
+static uint64_t netconf_request_memory = 0;
+static uint64_t netconf_request_memory_max = NETCONF_REQUEST_MEMORY_DEF;
+GMutex request_lock;
 
 /* Maintain a list of open sessions */
 static GList *open_sessions_list = NULL;
@@ -86,6 +156,64 @@ GMutex session_lock;
 /* Global statistics */
 global_statistics_t netconf_global_stats;
 
+/* Generation counters for the running datastore and each top level subtree,
+ * used to generate entity tags for get-config replies */
+static GHashTable *generation_table = NULL;
+static GList *generation_watches = NULL;
+static guint64 running_generation = 0;
+static guint32 generation_nonce = 0;
+GMutex generation_lock;
+
+/* Values NETCONF has set in running and already recorded, as a queue per path,
+ * so the watch can tell them from changes made elsewhere. A set that changes
+ * nothing is never seen by the watch, so the table is bounded */
+#define GENERATION_APPLIED_MAX 16384
+static GHashTable *generation_applied = NULL;
+
+/* Bounded journal of paths changed in the running datastore, in generation order */
+#define NETCONF_JOURNAL_SIZE 4096
+typedef struct _journal_entry
+{
+    guint64 seq;
+    char *path;
+} journal_entry;
+static journal_entry change_journal[NETCONF_JOURNAL_SIZE];
+static guint64 journal_count = 0;
+static guint64 journal_evicted_seq = 0;
+
+/* Uncommitted changes to the candidate datastore, one change tree per top level
+ * root with "" marking deleted leaves, laid over running when read. Conditions
+ * from candidate edits are keyed by "path\ncondition" and checked on commit */
+static GList *candidate_roots = NULL;
+static GHashTable *candidate_conditions = NULL;
+GMutex candidate_data_lock;
+
+/* File holding the startup datastore, NULL if there is no startup datastore */
+static gchar *startup_path = NULL;
+
+/* Directory config files may be exported to and restored from, NULL if none */
+static gchar *export_path = NULL;
+
+/* The hello sent to every session, rendered when the models are loaded and
+ * split where the session id goes */
+#define HELLO_SESSION_ID "@session-id@"
+static gchar *hello_prefix = NULL;
+static gchar *hello_suffix = NULL;
+
+/* Optional journal of changes to running saved since the startup snapshot was
+ * written. The snapshot and journal carry the same base tag, so a journal left
+ * behind by an older snapshot is never replayed. The config paths changed
+ * since the last save, by NETCONF or anyone else, are collected from the watch
+ * on running and their values read when the next save is made. This is only
+ * done once a snapshot has been written by this process, as until then there
+ * is nothing to add to */
+#define STARTUP_JOURNAL_MIN (64 * 1024)
+#define STARTUP_DIRTY_MAX (16 * 1024)
+static gchar *startup_journal = NULL;
+static gchar *startup_base = NULL;
+static GHashTable *startup_dirty = NULL;
+GMutex startup_lock;
+
 sch_instance *
 netconf_get_g_schema (void)
 {
@@ -274,6 +402,27 @@ _free_error_parms (nc_error_parms error_parms)
     g_hash_table_destroy (error_parms.info);
 }
 
+/* An error for one part of a request, kept until the reply is sent */
+static nc_error_parms *
+_new_error_parms (NC_ERR_TAG err_tag, NC_ERR_TYPE err_type, const char *path)
+{
+    nc_error_parms *error_parms = g_malloc (sizeof (*error_parms));
+
+    *error_parms = NC_ERROR_PARMS_INIT;
+    error_parms->tag = err_tag;
+    error_parms->type = err_type;
+    if (path)
+        g_hash_table_insert (error_parms->info, "error-path", g_strdup (path));
+    return error_parms;
+}
+
+static void
+_destroy_error_parms (gpointer data)
+{
+    _free_error_parms (*(nc_error_parms *) data);
+    g_free (data);
+}
+
 static char *
 get_rpc_operation_type (xmlNode *rpc)
 {
@@ -478,33 +627,36 @@ send_rpc_ok (struct netconf_session *session, xmlNode * rpc, bool closing)
 }
 
 /**
- * Actually send the RPC error message - all information is contained in the nc_error_parms structure.
+ * Add one rpc-error element to a reply - all information is contained in the nc_error_parms structure.
  */
-static bool
-_send_rpc_error (struct netconf_session *session, xmlNode * rpc, nc_error_parms error_parms)
+static void
+_add_rpc_error (xmlNode *reply, nc_error_parms error_parms)
 {
-    xmlDoc *doc;
     xmlNode *child;
     xmlNode *error_msg = NULL;
     xmlNode *error_info = NULL;
-    xmlChar *xmlbuff = NULL;
-    char *header = NULL;
-    int len;
-    bool ret = true;
-
-    /* Generate reply */
-    if (rpc)
-        doc = create_rpc (BAD_CAST "rpc-reply", xmlGetProp (rpc, BAD_CAST "message-id"));
-    else
-        doc = create_rpc (BAD_CAST "rpc-reply", NULL);
+    char *error_path;
+    guint info_size = 0;
 
-    child = xmlNewChild (xmlDocGetRootElement (doc), NULL, BAD_CAST "rpc-error", NULL);
+    child = xmlNewChild (reply, NULL, BAD_CAST "rpc-error", NULL);
     xmlNewChild (child, NULL, BAD_CAST "error-tag",
                  BAD_CAST rpc_error_tag_to_string (error_parms.tag));
     xmlNewChild (child, NULL, BAD_CAST "error-type",
                  BAD_CAST rpc_error_type_to_string (error_parms.type));
     xmlNewChild (child, NULL, BAD_CAST "error-severity", BAD_CAST "error");
 
+    /* Errors for part of an edit say which part */
+    if (error_parms.info != NULL)
+    {
+        info_size = g_hash_table_size (error_parms.info);
+        error_path = g_hash_table_lookup (error_parms.info, "error-path");
+        if (error_path)
+        {
+            xmlNewTextChild (child, NULL, BAD_CAST "error-path", BAD_CAST error_path);
+            info_size--;
+        }
+    }
+
     if (!error_parms.msg || g_strcmp0 (error_parms.msg->str, "") == 0)
     {
         g_string_printf (error_parms.msg, "%s", rpc_error_tag_to_msg (error_parms.tag));
@@ -514,11 +666,33 @@ _send_rpc_error (struct netconf_session *session, xmlNode * rpc, nc_error_parms
     xmlNodeSetContent (error_msg, BAD_CAST error_parms.msg->str);
     xmlAddChild (child, error_msg);
 
-    if (error_parms.info != NULL && g_hash_table_size (error_parms.info) > 0)
+    if (info_size > 0)
     {
         error_info = _create_error_info_xml (error_parms);
         xmlAddChild (child, error_info);
     }
+}
+
+/**
+ * Send a reply holding an rpc-error for each of the nc_error_parms in the list.
+ */
+static bool
+_send_rpc_errors (struct netconf_session *session, xmlNode * rpc, GList *errors)
+{
+    xmlDoc *doc;
+    xmlChar *xmlbuff = NULL;
+    char *header = NULL;
+    int len;
+    bool ret = true;
+
+    /* Generate reply */
+    if (rpc)
+        doc = create_rpc (BAD_CAST "rpc-reply", xmlGetProp (rpc, BAD_CAST "message-id"));
+    else
+        doc = create_rpc (BAD_CAST "rpc-reply", NULL);
+
+    for (GList *iter = errors; iter; iter = g_list_next (iter))
+        _add_rpc_error (xmlDocGetRootElement (doc), *(nc_error_parms *) iter->data);
 
     xmlDocDumpMemoryEnc (doc, &xmlbuff, &len, "UTF-8");
     header = g_strdup_printf ("\n#%d\n", len);
@@ -556,6 +730,17 @@ _send_rpc_error (struct netconf_session *session, xmlNode * rpc, nc_error_parms
     return ret;
 }
 
+/**
+ * Actually send the RPC error message - all information is contained in the nc_error_parms structure.
+ */
+static bool
+_send_rpc_error (struct netconf_session *session, xmlNode * rpc, nc_error_parms error_parms)
+{
+    GList errors = { &error_parms, NULL, NULL };
+
+    return _send_rpc_errors (session, rpc, &errors);
+}
+
 /**
  * Fully parameterised send_rpc_error. This can be used to send a variety of RPC error types, depending
  * on what is passed in. Parameters session, rpc, err_tag, err_type and error_msg are mandatory, the rest are
@@ -576,7 +761,13 @@ send_rpc_error_full (struct netconf_session *session, xmlNode *rpc, NC_ERR_TAG e
     error_parms.type = err_type;
     if (!bad_elem && !no_info)
     {
-        gchar *sess_id_str = g_strdup_printf ("%u", running_ds_lock.nc_sess.id);
+        /* Report the session holding whichever lock is in the way */
+        struct ds_lock *lock = &running_ds_lock;
+        if (!(lock->locked && lock->nc_sess.id != session->id) && candidate_ds_lock.locked)
+            lock = &candidate_ds_lock;
+        if (!(lock->locked && lock->nc_sess.id != session->id) && startup_ds_lock.locked)
+            lock = &startup_ds_lock;
+        gchar *sess_id_str = g_strdup_printf ("%u", lock->nc_sess.id);
         g_hash_table_insert (error_parms.info, "session-id", sess_id_str);
         /* No need to free, hash table cleanup will do that */
     }
@@ -601,33 +792,13 @@ send_rpc_error_full (struct netconf_session *session, xmlNode *rpc, NC_ERR_TAG e
 }
 
 static bool
-send_rpc_data (struct netconf_session *session, xmlNode * rpc, GList *xml_list)
+send_rpc_reply_doc (struct netconf_session *session, xmlDoc *doc)
 {
-    xmlDoc *doc;
-    xmlNode * data;
-    xmlNode *child;
     xmlChar *xmlbuff;
-    GList *list;
     char *header = NULL;
     int len;
     bool ret = true;
 
-    /* Generate reply */
-    doc = create_rpc ( BAD_CAST "rpc-reply", xmlGetProp (rpc, BAD_CAST "message-id"));
-    child = xmlNewChild (xmlDocGetRootElement (doc), NULL, BAD_CAST "data", NULL);
-    if (!xml_list)
-    {
-        xmlAddChildList (child, NULL);
-    }
-    else
-    {
-        for (list = g_list_first (xml_list); list; list = g_list_next (list))
-        {
-            data = list->data;
-            xmlAddChildList (child, data);
-        }
-    }
-
     xmlDocDumpMemoryEnc (doc, &xmlbuff, &len, "UTF-8");
     header = g_strdup_printf ("\n#%d\n", len);
 
@@ -641,7 +812,7 @@ send_rpc_data (struct netconf_session *session, xmlNode * rpc, GList *xml_list)
     VERBOSE ("TX(%ld):\n%s", strlen (header), header);
     if (write (session->fd, xmlbuff, len) != len)
     {
-        ERROR ("TX failed: Sending %d bytes of hello\n", len);
+        ERROR ("TX failed: Sending %d bytes of reply\n", len);
         ret = false;
         goto cleanup;
     }
@@ -658,6 +829,40 @@ send_rpc_data (struct netconf_session *session, xmlNode * rpc, GList *xml_list)
   cleanup:
     g_free (header);
     xmlFree (xmlbuff);
+    return ret;
+}
+
+static bool
+send_rpc_data (struct netconf_session *session, xmlNode * rpc, GList *xml_list,
+               const char *etag, bool not_modified)
+{
+    xmlDoc *doc;
+    xmlNode * data;
+    xmlNode *child;
+    GList *list;
+    bool ret;
+
+    /* Generate reply */
+    doc = create_rpc ( BAD_CAST "rpc-reply", xmlGetProp (rpc, BAD_CAST "message-id"));
+    child = xmlNewChild (xmlDocGetRootElement (doc), NULL, BAD_CAST "data", NULL);
+    if (etag)
+        xmlNewProp (child, BAD_CAST "etag", BAD_CAST etag);
+    if (not_modified)
+        xmlNewProp (child, BAD_CAST "not-modified", BAD_CAST "true");
+    if (!xml_list)
+    {
+        xmlAddChildList (child, NULL);
+    }
+    else
+    {
+        for (list = g_list_first (xml_list); list; list = g_list_next (list))
+        {
+            data = list->data;
+            xmlAddChildList (child, data);
+        }
+    }
+
+    ret = send_rpc_reply_doc (session, doc);
     xmlFreeDoc (doc);
     if (xml_list)
         g_list_free (xml_list);
@@ -703,8 +908,57 @@ schema_set_model_information (xmlNode * cap)
     }
 }
 
+/* Parse into a dictionary layered on the schema names, so names from the
+ * schema are shared with it rather than copied into every document */
+static void
+parser_use_names (xmlParserCtxt *ctxt)
+{
+    xmlDict *dict;
+
+    if (!sch_names_dict () || !(dict = xmlDictCreateSub (sch_names_dict ())))
+        return;
+    xmlDictFree (ctxt->dict);
+    ctxt->dict = dict;
+    ctxt->str_xml = xmlDictLookup (dict, BAD_CAST "xml", 3);
+    ctxt->str_xmlns = xmlDictLookup (dict, BAD_CAST "xmlns", 5);
+    ctxt->str_xml_ns = xmlDictLookup (dict, XML_XML_NAMESPACE, 36);
+}
+
+/* The parser for a session, reused for every message. Names the schema does
+ * not know are kept in its dictionary, so it is started again once it has
+ * collected too many of them */
+static xmlParserCtxt *
+session_parser (struct netconf_session *session)
+{
+    if (session->parser &&
+        xmlDictSize (session->parser->dict) > session->parser_names + PARSER_NAMES_MAX)
+    {
+        xmlFreeParserCtxt (session->parser);
+        session->parser = NULL;
+    }
+    if (!session->parser)
+    {
+        session->parser = xmlNewParserCtxt ();
+        if (!session->parser)
+            return NULL;
+        parser_use_names (session->parser);
+        session->parser_names = xmlDictSize (session->parser->dict);
+    }
+    return session->parser;
+}
+
+static xmlDoc *
+parse_message (struct netconf_session *session, const char *buffer, int len)
+{
+    xmlParserCtxt *ctxt = session_parser (session);
+
+    if (!ctxt)
+        return NULL;
+    return xmlCtxtReadMemory (ctxt, buffer, len, NULL, NULL, NETCONF_PARSE_OPTIONS);
+}
+
 static bool
-validate_hello (char *buffer, int buf_len)
+validate_hello (struct netconf_session *session, char *buffer, int buf_len)
 {
     xmlDoc *doc = NULL;
     xmlNode *root;
@@ -713,7 +967,7 @@ validate_hello (char *buffer, int buf_len)
     xmlChar *cap;
     bool found_base11 = false;
 
-    doc = xmlParseMemory (buffer, buf_len);
+    doc = parse_message (session, buffer, buf_len);
     if (!doc)
     {
         ERROR ("XML: Invalid hello message\n");
@@ -847,7 +1101,7 @@ handle_hello (struct netconf_session *session)
     }
 
     /* Validate hello */
-    if (!validate_hello (buffer, (endpt - buffer)))
+    if (!validate_hello (session, buffer, (endpt - buffer)))
     {
         ret = false;
     }
@@ -856,15 +1110,19 @@ handle_hello (struct netconf_session *session)
     return ret;
 }
 
-static bool
-send_hello (struct netconf_session *session)
+/* Render the hello once, as the text either side of the session id */
+static void
+hello_render (void)
 {
-    bool ret = true;
     xmlDoc *doc = NULL;
     xmlNode *root, *node, *child;
     xmlChar *hello_resp = NULL;
-    char session_id_str[32];
     int hello_resp_len = 0;
+    char *id;
+
+    g_free (hello_prefix);
+    g_free (hello_suffix);
+    hello_prefix = hello_suffix = NULL;
 
     doc = create_rpc (BAD_CAST "hello", NULL);
     root = xmlDocGetRootElement (doc);
@@ -877,37 +1135,73 @@ send_hello (struct netconf_session *session)
     xmlNodeSetContent (child,
                        BAD_CAST "urn:ietf:params:netconf:capability:writable-running:1.0");
     child = xmlNewChild (node, NULL, BAD_CAST "capability", NULL);
+    xmlNodeSetContent (child, BAD_CAST "urn:ietf:params:netconf:capability:candidate:1.0");
+    child = xmlNewChild (node, NULL, BAD_CAST "capability", NULL);
+    xmlNodeSetContent (child, BAD_CAST "urn:ietf:params:netconf:capability:validate:1.1");
+    child = xmlNewChild (node, NULL, BAD_CAST "capability", NULL);
+    xmlNodeSetContent (child, BAD_CAST "urn:ietf:params:netconf:capability:rollback-on-error:1.0");
+    if (startup_path)
+    {
+        child = xmlNewChild (node, NULL, BAD_CAST "capability", NULL);
+        xmlNodeSetContent (child, BAD_CAST "urn:ietf:params:netconf:capability:startup:1.0");
+    }
+    child = xmlNewChild (node, NULL, BAD_CAST "capability", NULL);
     xmlNodeSetContent (child,
                        BAD_CAST "urn:ietf:params:netconf:capability:with-defaults:1.0?basic-mode=explicit&amp;also-supported=report-all,trim");
+    child = xmlNewChild (node, NULL, BAD_CAST "capability", NULL);
+    xmlNodeSetContent (child, BAD_CAST NETCONF_CHANGES_CAPABILITY);
     /* Find all models in the entire tree */
     schema_set_model_information (node);
-    snprintf (session_id_str, sizeof (session_id_str), "%u", session->id);
     node = xmlNewChild (root, NULL, BAD_CAST "session-id", NULL);
-    xmlNodeSetContent (node, BAD_CAST session_id_str);
+    xmlNodeSetContent (node, BAD_CAST HELLO_SESSION_ID);
     xmlDocDumpMemoryEnc (doc, &hello_resp, &hello_resp_len, "UTF-8");
     xmlFreeDoc (doc);
 
-    /* Send reply */
-    if (write (session->fd, hello_resp, hello_resp_len) != hello_resp_len)
+    /* The session id is the last thing in the hello */
+    id = hello_resp ? g_strrstr ((char *) hello_resp, HELLO_SESSION_ID) : NULL;
+    if (id)
     {
-        ERROR ("TX failed: Sending %d bytes of hello\n", hello_resp_len);
-        ret = false;
-        goto cleanup;
+        hello_prefix = g_strndup ((char *) hello_resp, id - (char *) hello_resp);
+        hello_suffix = g_strdup (id + strlen (HELLO_SESSION_ID));
     }
-    VERBOSE ("TX(%d):\n%.*s", hello_resp_len, hello_resp_len, (char *) hello_resp);
-    if (write (session->fd, NETCONF_BASE_1_0_END, strlen (NETCONF_BASE_1_0_END)) !=
-        strlen (NETCONF_BASE_1_0_END))
+    else
     {
-        ERROR ("TX failed: Sending %ld bytes of hello trailer\n",
-               strlen (NETCONF_BASE_1_0_END));
-        ret = false;
-        goto cleanup;
+        ERROR ("XML: Failed to render hello\n");
     }
-    VERBOSE ("TX(%ld):\n%s\n", strlen (NETCONF_BASE_1_0_END), NETCONF_BASE_1_0_END);
-
-  cleanup:
     xmlFree (hello_resp);
-    return ret;
+}
+
+static bool
+send_hello (struct netconf_session *session)
+{
+    char session_id_str[32];
+    struct iovec iov[4];
+    ssize_t hello_resp_len = 0;
+
+    if (!hello_prefix)
+        return false;
+
+    snprintf (session_id_str, sizeof (session_id_str), "%u", session->id);
+    iov[0].iov_base = hello_prefix;
+    iov[0].iov_len = strlen (hello_prefix);
+    iov[1].iov_base = session_id_str;
+    iov[1].iov_len = strlen (session_id_str);
+    iov[2].iov_base = hello_suffix;
+    iov[2].iov_len = strlen (hello_suffix);
+    iov[3].iov_base = NETCONF_BASE_1_0_END;
+    iov[3].iov_len = strlen (NETCONF_BASE_1_0_END);
+    for (int i = 0; i < G_N_ELEMENTS (iov); i++)
+        hello_resp_len += iov[i].iov_len;
+
+    /* Send reply */
+    if (writev (session->fd, iov, G_N_ELEMENTS (iov)) != hello_resp_len)
+    {
+        ERROR ("TX failed: Sending %zd bytes of hello\n", hello_resp_len);
+        return false;
+    }
+    VERBOSE ("TX(%zd):\n%s%s%s%s\n", hello_resp_len, hello_prefix, session_id_str, hello_suffix,
+             NETCONF_BASE_1_0_END);
+    return true;
 }
 
 static GNode *
@@ -933,133 +1227,387 @@ get_full_tree ()
     return tree;
 }
 
-static gboolean
-process_subtree_query_leaves (GNode *node, gpointer data)
+/* Find the node for path in a tree whose root is named "/" or by a path prefix,
+ * optionally creating any missing nodes */
+static GNode *
+tree_path_node (GNode *root, const char *path, bool create)
 {
-    GNode *qnode;
-    q_param *qparam = (q_param *) data;
-    int depth = 0;
+    const char *rname = APTERYX_NAME (root);
+    size_t len = g_strcmp0 (rname, "/") == 0 ? 0 : strlen (rname);
+    gchar **parts;
+    GNode *node = root;
 
-    /* Subtree queries have null or value terminated trees */
-    node = node->parent;
+    if (strncmp (path, rname, len) != 0 || (path[len] != '/' && path[len] != '\0'))
+        return NULL;
 
-    if (node)
+    parts = g_strsplit (path + len, "/", -1);
+    for (int i = 0; node && parts[i]; i++)
     {
-        qnode = node;
-        while (qnode->parent)
-        {
-            qnode = qnode->parent;
-            depth++;
-        }
-        depth++;
+        GNode *child;
 
-        if (g_strcmp0 (APTERYX_NAME(node), "*") == 0)
-        {
-            qparam->deepest_leaf = node;
-            qparam->depth = depth;
-            return true;
-        }
-        else if (depth > qparam->depth)
-        {
-            qparam->deepest_leaf = node;
-            qparam->depth = depth;
-        }
+        if (parts[i][0] == '\0')
+            continue;
+        child = apteryx_find_child (node, parts[i]);
+        if (!child && create)
+            child = APTERYX_NODE (node, g_strdup (parts[i]));
+        node = child;
     }
-    return false;
+    g_strfreev (parts);
+    return node;
 }
 
+/* Remember a container at the max-depth limit by its query path, with "*"
+ * for any list entry, so it can be reported without fetching below it */
 static void
-cleanup_empty_branches (xmlNode *node, int depth, int max_depth, bool *root_deleted)
+depth_limit_add (GList **limits, GNode *qnode, const char *name)
 {
-    xmlNode *cur_node = NULL;
-    xmlNode *next_node = NULL;
+    char *path = apteryx_node_path (qnode);
 
-    if (depth < max_depth - 1)
-    {
-        for (cur_node = node; cur_node; cur_node = next_node)
-        {
-            next_node = cur_node->next;
-            if (cur_node->type == XML_ELEMENT_NODE)
-            {
-                if (!cur_node->children)
-                {
-                    xmlUnlinkNode (cur_node);
-                    xmlFreeNode (cur_node);
-                    if (depth == 0 && cur_node == node)
-                        *root_deleted = true;
-                    continue;
-                }
-            }
-            cleanup_empty_branches (cur_node->children, depth + 1, max_depth, root_deleted);
-        }
-    }
+    *limits = g_list_prepend (*limits, name ? g_strdup_printf ("%s/%s", path, name) : g_strdup (path));
+    g_free (path);
 }
 
+/* Query just the keys of the entries of a list */
 static void
-cleanup_xpath_tree (GHashTable *node_table, xmlNode *node, int depth, int *max_depth, bool *root_deleted)
+add_list_keys (sch_node *list, GNode *entry, bool is_subtree)
 {
-    xmlNode *cur_node = NULL;
-    xmlNode *next_node = NULL;
+    GList *keys = sch_list_keys (list);
 
-    for (cur_node = node; cur_node; cur_node = next_node)
+    for (GList *key = keys; key; key = key->next)
     {
-        next_node = cur_node->next;
-        if (cur_node->type == XML_ELEMENT_NODE) {
-            if (!g_hash_table_lookup (node_table, cur_node))
-            {
-                xmlUnlinkNode (cur_node);
-                xmlFreeNode (cur_node);
-                if (depth == 0 && cur_node == node)
-                    *root_deleted = true;
-
-                continue;
-            }
-        }
-
-        cleanup_xpath_tree (node_table, cur_node->children, depth + 1, max_depth, root_deleted);
+        GNode *knode = APTERYX_NODE (entry, g_strdup (key->data));
+        if (is_subtree)
+            g_node_prepend_data (knode, NULL);
     }
-    if (depth > *max_depth)
-        *max_depth = depth;
-
-    if (depth == 0)
-        cleanup_empty_branches (node, depth, *max_depth, root_deleted);
+    g_list_free_full (keys, g_free);
 }
 
-static bool
-_xpath_mark_list_nodes (sch_node *schema, xmlNode *node, int flags, int depth, GHashTable *node_table)
+/* Add query nodes for up to depth levels of schema below the query node.
+ * Subtree queries terminate each leaf with a NULL node. Nothing is queried
+ * below a container at the limit, its path is added to limits instead. */
+static void
+add_depth_limited_children (sch_node *schema, GNode *qnode, int depth, bool is_subtree,
+                            GList **limits)
 {
     sch_node *s_node;
-    sch_node *child;
-    const char *target_name;
-    char *name;
-    char *colon;
-    bool rc = true;
+    GNode *child;
+    GNode *entry;
 
-    for (xmlNode *cur_node = node; cur_node; cur_node = cur_node->next)
+    if (depth <= 0)
+        return;
+
+    for (s_node = sch_node_child_first (schema); s_node; s_node = sch_node_next_sibling (s_node))
     {
-        if (g_hash_table_lookup (node_table, cur_node))
+        if (!sch_is_readable (s_node) || sch_is_proxy (s_node))
+            continue;
+
+        if (sch_is_leaf_list (s_node))
         {
-            target_name = (const char *) cur_node->name;
-            for (s_node = schema; s_node; s_node = sch_node_next_sibling (s_node))
+            child = APTERYX_NODE (qnode, sch_name (s_node));
+            entry = APTERYX_NODE (child, g_strdup ("*"));
+            if (is_subtree)
+                g_node_prepend_data (entry, NULL);
+        }
+        else if (sch_is_list (s_node))
+        {
+            child = APTERYX_NODE (qnode, sch_name (s_node));
+            entry = APTERYX_NODE (child, g_strdup ("*"));
+            if (depth > 1)
+            {
+                add_depth_limited_children (sch_node_child_first (s_node), entry,
+                                            depth - 1, is_subtree, limits);
+            }
+            else
+            {
+                /* At the limit just report the list entry keys */
+                add_list_keys (s_node, entry, is_subtree);
+            }
+        }
+        else if (!sch_is_leaf (s_node))
+        {
+            if (depth > 1)
+            {
+                child = APTERYX_NODE (qnode, sch_name (s_node));
+                add_depth_limited_children (s_node, child, depth - 1, is_subtree, limits);
+                if (!child->children)
+                    apteryx_free_tree (child);
+            }
+            else if (limits)
+            {
+                char *name = sch_name (s_node);
+                depth_limit_add (limits, qnode, name);
+                g_free (name);
+            }
+        }
+        else
+        {
+            child = APTERYX_NODE (qnode, sch_name (s_node));
+            if (is_subtree)
+                g_node_prepend_data (child, NULL);
+        }
+    }
+}
+
+/* Expand the query below qnode (which refers to schema) to include at most
+ * max_depth levels of data including the node itself (RFC 8526 max-depth) */
+static void
+query_limit_depth (GNode *qnode, sch_node *schema, int max_depth, bool is_subtree,
+                   GList **limits)
+{
+    if (sch_is_list (schema))
+    {
+        /* The list entries are the selected nodes */
+        qnode = APTERYX_NODE (qnode, g_strdup ("*"));
+        if (max_depth == 1)
+        {
+            add_list_keys (schema, qnode, is_subtree);
+            return;
+        }
+        schema = sch_node_child_first (schema);
+    }
+    else if (max_depth == 1)
+    {
+        depth_limit_add (limits, qnode, NULL);
+        return;
+    }
+    add_depth_limited_children (schema, qnode, max_depth - 1, is_subtree, limits);
+}
+
+/* Find the concrete paths a limit path refers to, expanding each "*" to the
+ * list entries in the reply */
+static void
+depth_limit_expand (GNode *node, GString *prefix, gchar **parts, GList **paths)
+{
+    gsize len = prefix->len;
+
+    if (!parts[0])
+    {
+        *paths = g_list_prepend (*paths, g_strdup (prefix->str));
+        return;
+    }
+    if (parts[0][0] == '\0')
+    {
+        depth_limit_expand (node, prefix, parts + 1, paths);
+        return;
+    }
+    if (g_strcmp0 (parts[0], "*") == 0)
+    {
+        for (GNode *child = node ? node->children : NULL; child; child = child->next)
+        {
+            g_string_append_printf (prefix, "/%s", APTERYX_NAME (child));
+            depth_limit_expand (child, prefix, parts + 1, paths);
+            g_string_truncate (prefix, len);
+        }
+        return;
+    }
+    g_string_append_printf (prefix, "/%s", parts[0]);
+    depth_limit_expand (node ? apteryx_find_child (node, parts[0]) : NULL, prefix, parts + 1, paths);
+    g_string_truncate (prefix, len);
+}
+
+/* Add each container at the max-depth limit that holds data to the reply as an
+ * empty node. Whether it holds data is a single level search, so nothing
+ * below the limit is fetched */
+static void
+depth_limit_add_containers (GNode **tree, GList *limits)
+{
+    GString *prefix = g_string_sized_new (256);
+    GList *paths = NULL;
+
+    for (GList *iter = limits; iter; iter = g_list_next (iter))
+    {
+        gchar **parts = g_strsplit ((char *) iter->data, "/", -1);
+        depth_limit_expand (*tree, prefix, parts, &paths);
+        g_strfreev (parts);
+    }
+    g_string_free (prefix, TRUE);
+
+    for (GList *iter = paths; iter; iter = g_list_next (iter))
+    {
+        gchar *search = g_strdup_printf ("%s/", (char *) iter->data);
+        GList *children = apteryx_search (search);
+
+        if (children)
+        {
+            if (!*tree)
+                *tree = APTERYX_NODE (NULL, g_strdup ("/"));
+            tree_path_node (*tree, (char *) iter->data, true);
+        }
+        g_list_free_full (children, free);
+        g_free (search);
+    }
+    g_list_free_full (paths, g_free);
+}
+
+static gboolean
+find_query_wildcards (GNode *node, gpointer data)
+{
+    GList **stars = (GList **) data;
+
+    /* Only interested in wildcards that fetch everything from here down */
+    if (node->parent && g_strcmp0 (APTERYX_NAME (node), "*") == 0 &&
+        (!node->children || (!node->children->next && !node->children->data)))
+    {
+        *stars = g_list_prepend (*stars, node);
+    }
+    return FALSE;
+}
+
+/* Replace the "everything from here down" wildcards of a query with an explicit
+ * query limited to max_depth levels, so deeper levels are never fetched */
+static void
+query_replace_wildcards (GNode *query, GNode **qnode, int max_depth, bool is_subtree,
+                         GList **limits)
+{
+    GList *stars = NULL;
+    GList *iter;
+
+    g_node_traverse (query, G_PRE_ORDER, G_TRAVERSE_ALL, -1, find_query_wildcards, &stars);
+    for (iter = stars; iter; iter = g_list_next (iter))
+    {
+        GNode *star = (GNode *) iter->data;
+        GNode *parent = star->parent;
+        char *path = apteryx_node_path (parent);
+        sch_node *schema = sch_lookup (g_schema, path);
+
+        if (schema)
+        {
+            if (qnode && *qnode == star)
+                *qnode = parent;
+            g_node_unlink (star);
+            apteryx_free_tree (star);
+            query_limit_depth (parent, schema, max_depth, is_subtree, limits);
+        }
+        g_free (path);
+    }
+    g_list_free (stars);
+}
+
+/* Get the full tree with a single query fetching at most max_depth levels */
+static GNode *
+get_full_tree_depth (int max_depth, GList **limits)
+{
+    GNode *query = APTERYX_NODE (NULL, g_strdup_printf ("/"));
+    GNode *tree = NULL;
+
+    add_depth_limited_children (sch_get_root_schema (g_schema), query, max_depth, false, limits);
+    if (query->children)
+        tree = apteryx_query (query);
+    apteryx_free_tree (query);
+    return tree;
+}
+
+static gboolean
+process_subtree_query_leaves (GNode *node, gpointer data)
+{
+    GNode *qnode;
+    q_param *qparam = (q_param *) data;
+    int depth = 0;
+
+    /* Subtree queries have null or value terminated trees */
+    node = node->parent;
+
+    if (node)
+    {
+        qnode = node;
+        while (qnode->parent)
+        {
+            qnode = qnode->parent;
+            depth++;
+        }
+        depth++;
+
+        if (g_strcmp0 (APTERYX_NAME(node), "*") == 0)
+        {
+            qparam->deepest_leaf = node;
+            qparam->depth = depth;
+            return true;
+        }
+        else if (depth > qparam->depth)
+        {
+            qparam->deepest_leaf = node;
+            qparam->depth = depth;
+        }
+    }
+    return false;
+}
+
+static void
+cleanup_empty_branches (xmlNode *node, int depth, int max_depth, bool *root_deleted)
+{
+    xmlNode *cur_node = NULL;
+    xmlNode *next_node = NULL;
+
+    if (depth < max_depth - 1)
+    {
+        for (cur_node = node; cur_node; cur_node = next_node)
+        {
+            next_node = cur_node->next;
+            if (cur_node->type == XML_ELEMENT_NODE)
             {
-                name = sch_name (s_node);
-                if (depth == 0)
+                if (!cur_node->children)
                 {
-                    colon = strchr (name, ':');
-                    if (colon)
-                    {
-                        char *tmp = name;
-                        name = g_strdup (colon + 1);
-                        g_free (tmp);
-                    }
+                    xmlUnlinkNode (cur_node);
+                    xmlFreeNode (cur_node);
+                    if (depth == 0 && cur_node == node)
+                        *root_deleted = true;
+                    continue;
                 }
+            }
+            cleanup_empty_branches (cur_node->children, depth + 1, max_depth, root_deleted);
+        }
+    }
+}
 
-                if (g_strcmp0 (name, target_name) == 0)
-                {
-                    g_free (name);
+static void
+cleanup_xpath_tree (GHashTable *node_table, xmlNode *node, int depth, int *max_depth, bool *root_deleted)
+{
+    xmlNode *cur_node = NULL;
+    xmlNode *next_node = NULL;
+
+    for (cur_node = node; cur_node; cur_node = next_node)
+    {
+        next_node = cur_node->next;
+        if (cur_node->type == XML_ELEMENT_NODE) {
+            if (!g_hash_table_lookup (node_table, cur_node))
+            {
+                xmlUnlinkNode (cur_node);
+                xmlFreeNode (cur_node);
+                if (depth == 0 && cur_node == node)
+                    *root_deleted = true;
+
+                continue;
+            }
+        }
+
+        cleanup_xpath_tree (node_table, cur_node->children, depth + 1, max_depth, root_deleted);
+    }
+    if (depth > *max_depth)
+        *max_depth = depth;
+
+    if (depth == 0)
+        cleanup_empty_branches (node, depth, *max_depth, root_deleted);
+}
+
+static bool
+_xpath_mark_list_nodes (sch_node *schema, xmlNode *node, int flags, int depth, GHashTable *node_table)
+{
+    sch_node *s_node;
+    sch_node *child;
+    const xmlChar *target_name;
+    const xmlChar *name;
+    bool rc = true;
+
+    for (xmlNode *cur_node = node; cur_node; cur_node = cur_node->next)
+    {
+        if (g_hash_table_lookup (node_table, cur_node))
+        {
+            target_name = cur_node->name;
+            for (s_node = schema; s_node; s_node = sch_node_next_sibling (s_node))
+            {
+                name = sch_node_xml_name (s_node, depth == 0);
+                if (name == target_name || xmlStrEqual (name, target_name))
                     break;
-                }
-                g_free (name);
             }
 
             if (s_node)
@@ -1306,698 +1854,3002 @@ check_namespace_set (xmlNode *node, char **ns_href, char **ns_prefix)
     return schema_path;
 }
 
-/* Getting the response node with netconf is more complicated than restconf as they can have multiple nodes at
- * some levels. This routine uses the qnode and works upward to guide the tree node as it works from the top down */
-static GNode*
-get_response_node (GNode *tree, int *rdepth, GNode *qnode, sch_node **rschema)
+static gpointer
+copy_node_data (gconstpointer src, gpointer data)
 {
-    GNode *rnode = tree;
-    GNode *child = NULL;
-    int depth = *rdepth;
+    return g_strdup ((const char *) src);
+}
 
-    while (--depth && rnode)
+/* Merge a copy of src into dst, replacing any values in dst */
+static void
+overlay_merge (GNode *dst, GNode *src)
+{
+    if (APTERYX_HAS_VALUE (src))
     {
-        GNode *children = rnode->children;
+        while (dst->children)
+            apteryx_free_tree (dst->children);
+        g_node_append (dst, g_node_copy_deep (src->children, copy_node_data, NULL));
+        return;
+    }
 
-        if (children)
+    for (GNode *child = src->children; child; child = child->next)
+    {
+        GNode *match = apteryx_find_child (dst, APTERYX_NAME (child));
+
+        if (!match)
+            match = APTERYX_NODE (dst, g_strdup (APTERYX_NAME (child)));
+        overlay_merge (match, child);
+    }
+}
+
+/* Copy the parts of src selected by a query node. A query node without children,
+ * or ending in a NULL node or a lone "*", selects everything below it */
+static GNode *
+overlay_select (GNode *src, GNode *query)
+{
+    GNode *copy;
+
+    if (!query || !query->children || !query->children->data ||
+        (g_strcmp0 (APTERYX_NAME (query->children), "*") == 0 &&
+         !query->children->children && !query->children->next))
+    {
+        return g_node_copy_deep (src, copy_node_data, NULL);
+    }
+
+    copy = APTERYX_NODE (NULL, g_strdup (APTERYX_NAME (src)));
+    for (GNode *qchild = query->children; qchild; qchild = qchild->next)
+    {
+        for (GNode *child = src->children; child; child = child->next)
         {
-            GNode *pqnode = qnode;
-            int prdepth = depth;
-            while (pqnode && prdepth > 1)
+            if (g_strcmp0 (APTERYX_NAME (qchild), "*") == 0 ||
+                g_strcmp0 (APTERYX_NAME (qchild), APTERYX_NAME (child)) == 0)
             {
-                if (pqnode->parent)
-                    pqnode = pqnode->parent;
-                prdepth--;
+                g_node_append (copy, overlay_select (child, qchild));
             }
+        }
+    }
+    return copy;
+}
 
-            if (g_strcmp0 (APTERYX_NAME (pqnode), "*") == 0)
-                break;
+/* Remove deleted leaves and any branches left empty, returning true if node is now empty */
+static bool
+overlay_drop_deleted (GNode *node)
+{
+    GNode *child = node->children;
 
-            if (pqnode->parent)
-            {
-                for (child = children; child; child = child->next)
-                {
-                    if (g_strcmp0 (APTERYX_NAME (child), APTERYX_NAME (pqnode)) == 0)
-                    {
-                        break;
-                    }
-                }
+    if (APTERYX_HAS_VALUE (node))
+        return APTERYX_VALUE (node) == NULL || APTERYX_VALUE (node)[0] == '\0';
 
-                /* If the original query response does not have this part of the query
-                 * add it to the response */
-                if (!child)
-                {
-                    child = g_node_append_data (rnode, g_strdup (APTERYX_NAME (pqnode)));
-                    char *path = apteryx_node_path(child);
-                    sch_node *snode = sch_lookup (g_schema, path);
-                    if (snode)
-                    {
-                        *rschema = snode;
-                        *rdepth = depth + 1;
-                    }
-                    g_free (path);
-                }
-            }
-            if (child)
-                rnode = child;
-            else
-                rnode = rnode->children;
-        }
+    while (child)
+    {
+        GNode *next = child->next;
+
+        if (overlay_drop_deleted (child))
+            apteryx_free_tree (child);
+        child = next;
     }
-    return rnode;
+    return node->children == NULL;
 }
 
-static bool
-get_query_to_xml (struct netconf_session *session, xmlNode *rpc, GNode *query,
-                  GNode *qnode, int qdepth, char *path, char **ns_href,
-                  char **ns_prefix, xpath_type x_type, int schflags,
-                  bool is_subtree, bool is_filter, GList **xml_list,
-                  sch_node *rschema, int rdepth)
+/* Lay a list of change trees over the result of a query. A NULL query is a
+ * request for everything */
+static void
+overlay_roots (GList *roots, GNode **tree, GNode *query)
 {
-    GNode *tree = NULL;
-    xmlNode *xml = NULL;
+    bool changed = false;
 
-    /* Query database */
-    DEBUG ("NETCONF: GET %s\n", query ? APTERYX_NAME (query) : "/");
-    if (((logging & LOG_GET) && !(schflags & SCH_F_CONFIG)) ||
-        ((logging & LOG_GET_CONFIG) && (schflags & SCH_F_CONFIG)))
+    for (GList *iter = roots; iter; iter = g_list_next (iter))
     {
-        GString *qpath = g_string_new ("./");
-        GList *paths = generate_apteryx_query_node_paths (query, qpath, NULL);
-        for (GList *iter = paths; iter; iter = iter->next)
-            NOTICE ("%s: %s@%s id:%u path:%s\n",
-                    (schflags & SCH_F_CONFIG) ? "GET-CONFIG" : "GET",
-                    session->username, session->rem_addr, session->id,
-                    (gchar*) iter->data);
-
-        g_list_free_full (paths, g_free);
-        g_string_free (qpath, TRUE);
-    }
+        GNode *root = (GNode *) iter->data;
+        GNode *src = root;
+        GNode *qnode = NULL;
+        GNode *dst;
+        GNode *selected;
+        char *path;
 
-    if (query)
-    {
-        if (is_subtree)
-            tree = apteryx_query_full (query);
-        else
-            tree = apteryx_query (query);
-    }
-    else if (!is_filter)
-        tree = get_full_tree ();
+        /* Line the query up with this root */
+        if (query && g_strcmp0 (APTERYX_NAME (query), "/") == 0)
+        {
+            qnode = apteryx_find_child (query, APTERYX_NAME (root) + 1);
+            if (!qnode)
+                qnode = apteryx_find_child (query, "*");
+            if (!qnode)
+                continue;
+        }
+        else if (query)
+        {
+            src = tree_path_node (root, APTERYX_NAME (query), false);
+            if (!src)
+                continue;
+            qnode = query;
+        }
 
-    if (query && (schflags & SCH_F_ADD_DEFAULTS) && rschema)
-    {
-        GNode *rnode = NULL;
-        if (tree)
-            rnode = get_response_node (tree, &rdepth, qnode, &rschema);
+        if (!*tree)
+            *tree = APTERYX_NODE (NULL, g_strdup (query ? APTERYX_NAME (query) : "/"));
+        path = apteryx_node_path (src);
+        dst = tree_path_node (*tree, path, true);
+        g_free (path);
+        if (!dst)
+            continue;
 
-        sch_add_defaults (g_schema, rschema, &tree, &query, rnode, qnode, rdepth,
-                          qdepth, schflags);
+        selected = overlay_select (src, qnode);
+        overlay_merge (dst, selected);
+        apteryx_free_tree (selected);
+        changed = true;
     }
 
-    if (tree && (schflags & SCH_F_TRIM_DEFAULTS) && rschema)
+    if (changed && overlay_drop_deleted (*tree) && query)
     {
-        GNode *rnode = get_response_node (tree, &rdepth, qnode, &rschema);
-        sch_traverse_tree (g_schema, rschema, rnode, schflags);
+        apteryx_free_tree (*tree);
+        *tree = NULL;
     }
+}
 
-    apteryx_free_tree (query);
-
-    /* Convert result to XML */
-    xml = tree ? sch_gnode_to_xml (g_schema, NULL, tree, schflags) : NULL;
-    apteryx_free_tree (tree);
-
-    if (xml && x_type == XPATH_EVALUATE)
-        return xpath_evaluate (session, rpc, path, ns_href, ns_prefix, xml, schflags, xml_list);
-    else
-        *xml_list = g_list_append (*xml_list, xml);
-    return true;
+/* Lay uncommitted candidate changes over the result of a query on running */
+static void
+candidate_overlay (GNode **tree, GNode *query)
+{
+    g_mutex_lock (&candidate_data_lock);
+    overlay_roots (candidate_roots, tree, query);
+    g_mutex_unlock (&candidate_data_lock);
 }
 
+/* Add the saved records from a journal written on top of the snapshot with the
+ * given base tag to roots. Anything after the last commit was never saved */
 static bool
-get_query_schema (struct netconf_session *session, xmlNode *rpc, GNode *query,
-                  sch_node *qschema, char *path, char **ns_href, char **ns_prefix, xpath_type x_type,
-                  int schflags, bool is_filter, bool is_subtree, GList **xml_list)
+startup_journal_replay (const char *base, GList **roots)
 {
-    GNode *qnode = NULL;
-    sch_node *rschema = qschema;
-    int qdepth = 0;
-    int rdepth = 1;
-    int diff;
+    gchar *contents = NULL;
+    gchar **lines;
+    GNode *tree;
+    int last = 0;
+    bool ret = true;
 
-    /* Get the depth of the response which is the depth of the query
-     * or up until the first path wildcard */
-    qdepth = g_node_max_height (query);
-    qnode = query;
-    if (is_subtree)
+    if (!g_file_get_contents (startup_journal, &contents, NULL, NULL))
+        return true;
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+    if (!lines[0] || strncmp (lines[0], "base ", 5) != 0 || g_strcmp0 (lines[0] + 5, base) != 0)
     {
-        q_param qparam = { 0 };
+        VERBOSE ("STARTUP: Ignoring journal for another snapshot\n");
+        g_strfreev (lines);
+        return true;
+    }
 
-        /* Subtree queries end with a NULL data node or a value node, reduce the depth of the n-ary to compensate */
-        if (is_subtree)
-        {
-            if (qdepth)
-                qdepth--;
-        }
-        g_node_traverse (qnode, G_IN_ORDER, G_TRAVERSE_LEAVES, -1, process_subtree_query_leaves, &qparam);
-        rdepth = qparam.depth;
+    for (int i = 1; lines[i]; i++)
+    {
+        if (g_strcmp0 (lines[i], "commit") == 0)
+            last = i;
+    }
 
-        if (qparam.deepest_leaf)
-        {
-            qnode = qparam.deepest_leaf;
-            if (g_strcmp0 (APTERYX_NAME (qparam.deepest_leaf), "*") == 0)
-            {
-                if (qdepth == rdepth)
-                    rdepth--;
-                qdepth--;
-                if (qparam.deepest_leaf->parent)
-                    qnode = qparam.deepest_leaf->parent;
-            }
-        }
+    tree = APTERYX_NODE (NULL, g_strdup ("/"));
+    for (int i = 1; i < last && ret; i++)
+    {
+        char *tab = strchr (lines[i], '\t');
+        gchar *path;
+        GNode *node;
 
-        if (qparam.deepest_leaf && sch_node_parent (rschema) && sch_is_list (sch_node_parent (rschema)))
+        if (g_strcmp0 (lines[i], "commit") == 0)
+            continue;
+        if (!tab)
         {
-            /* We need to present the list rather than the key */
-            rschema = sch_node_parent (rschema);
-            if (rschema && qparam.deepest_leaf->parent)
-            {
-                char *s_name = sch_name (rschema);
-                if (qdepth >= rdepth && g_strcmp0 (s_name, APTERYX_NAME(qparam.deepest_leaf->parent)) != 0)
-                {
-                    qdepth--;
-                    rdepth--;
-                    qnode = qparam.deepest_leaf->parent;
-                }
-                g_free (s_name);
-            }
+            ERROR ("STARTUP: Bad record at line %d of \"%s\"\n", i + 1, startup_journal);
+            ret = false;
+            break;
         }
-
-        diff = qdepth - rdepth;
-        while (diff--)
-            rschema = sch_node_parent (rschema);
-
-        if (qdepth != rdepth && sch_node_parent (rschema) && sch_is_list (sch_node_parent (rschema)))
+        *tab = '\0';
+        path = g_strcompress (lines[i]);
+        node = tree_path_node (tree, path, true);
+        if (node && node != tree)
         {
-            /* We need to present the list rather than the key */
-            rschema = sch_node_parent (rschema);
-            rdepth--;
+            while (node->children)
+                apteryx_free_tree (node->children);
+            APTERYX_NODE (node, g_strcompress (tab + 1));
         }
+        g_free (path);
     }
-    else
+    g_strfreev (lines);
+
+    /* One tree per top level root, laid over the snapshot */
+    while (ret && tree->children)
     {
-        while (qnode &&
-                g_node_n_children (qnode) == 1 &&
-                g_strcmp0 (APTERYX_NAME (g_node_first_child (qnode)), "*") != 0)
-        {
-            qnode = g_node_first_child (qnode);
-            rdepth++;
-        }
+        GNode *child = tree->children;
+        gchar *name = g_strdup_printf ("/%s", APTERYX_NAME (child));
 
-        diff = qdepth - rdepth;
-        while (diff--)
-            rschema = sch_node_parent (rschema);
+        g_node_unlink (child);
+        g_free (child->data);
+        child->data = name;
+        *roots = g_list_append (*roots, child);
+    }
+    apteryx_free_tree (tree);
+    return ret;
+}
 
-        if (sch_node_parent (rschema) && sch_is_list (sch_node_parent (rschema)))
-        {
-            /* We need to present the list rather than the key */
-            rschema = sch_node_parent (rschema);
-            rdepth--;
-        }
+/* Read the startup datastore into one tree per top level root. A missing
+ * file is an empty datastore */
+static bool
+startup_load (GList **roots)
+{
+    xmlDoc *doc;
+    xmlNode *root;
+    xmlChar *base;
+    bool ret = true;
 
-        while (qnode && qnode->children)
-            qnode = qnode->children;
+    *roots = NULL;
+    if (!startup_path)
+        return true;
+
+    g_mutex_lock (&startup_lock);
+    if (!g_file_test (startup_path, G_FILE_TEST_EXISTS))
+    {
+        g_mutex_unlock (&startup_lock);
+        return true;
     }
 
-    /* Without a query we may need to add a wildcard to get everything from here down */
-    if (is_filter && qnode && qdepth == g_node_max_height (query) &&
-        !(schflags & SCH_F_DEPTH_ONE))
+    doc = xmlReadFile (startup_path, NULL, XML_PARSE_NONET);
+    root = doc ? xmlDocGetRootElement (doc) : NULL;
+    if (!root || xmlStrcmp (root->name, BAD_CAST "config") != 0)
     {
-        if (qschema && sch_node_child_first (qschema) && !(schflags & SCH_F_STRIP_DATA))
+        ERROR ("STARTUP: Failed to parse \"%s\"\n", startup_path);
+        xmlFreeDoc (doc);
+        g_mutex_unlock (&startup_lock);
+        return false;
+    }
+
+    for (xmlNode *node = xmlFirstElementChild (root); node && ret;
+         node = xmlNextElementSibling (node))
+    {
+        sch_xml_to_gnode_parms parms =
+            sch_xml_to_gnode (g_schema, NULL, node, 0, NC_OP_MERGE, true, false, NULL);
+        GNode *tree = sch_parm_tree (parms);
+
+        if (sch_parm_error (parms).tag != 0 || !tree)
         {
-            /* Get everything from here down if we do not already have a star */
-            if (!g_node_first_child (qnode) && g_strcmp0 (APTERYX_NAME (qnode), "*") != 0)
-            {
-                APTERYX_NODE (qnode, g_strdup ("*"));
-                DEBUG ("%*s%s\n", qdepth * 2, " ", "*");
-            }
+            ERROR ("STARTUP: Invalid \"%s\" in \"%s\"\n", (char *) node->name, startup_path);
+            apteryx_free_tree (tree);
+            ret = false;
         }
+        else
+            *roots = g_list_append (*roots, tree);
+        sch_parm_free (parms);
     }
 
-    return get_query_to_xml (session, rpc, query, qnode, qdepth, path, ns_href,
-                             ns_prefix, x_type, schflags, is_subtree, true, xml_list,
-                             rschema, rdepth);
+    /* Then whatever has been saved since the snapshot was written */
+    base = xmlGetProp (root, BAD_CAST "base");
+    if (ret && base && startup_journal)
+        ret = startup_journal_replay ((char *) base, roots);
+    xmlFree (base);
+    xmlFreeDoc (doc);
+    g_mutex_unlock (&startup_lock);
+
+    if (!ret)
+    {
+        g_list_free_full (*roots, (GDestroyNotify) apteryx_free_tree);
+        *roots = NULL;
+    }
+    return ret;
 }
 
+/* Answer a query from the startup datastore. A file that cannot be read
+ * has already been logged and reads as empty */
 static void
-cleanup_on_xpath_error (struct netconf_session *session, char *attr, gchar **split,
-                        char *ns_href, char *ns_prefix, char *path)
+startup_overlay (GNode **tree, GNode *query)
 {
-    free (attr);
-    g_strfreev(split);
-    g_free (ns_href);
-    g_free (ns_prefix);
-    g_free (path);
-    session->counters.in_bad_rpcs++;
-    netconf_global_stats.session_totals.in_bad_rpcs++;
+    GList *roots = NULL;
+
+    if (startup_load (&roots))
+    {
+        overlay_roots (roots, tree, query);
+        g_list_free_full (roots, (GDestroyNotify) apteryx_free_tree);
+    }
 }
 
+/* A descriptor running config is streamed to, with a count and checksum of
+ * everything written */
+typedef struct _config_stream
+{
+    int fd;
+    GChecksum *checksum;
+    gsize bytes;
+} config_stream;
+
 static int
-get_process_action (struct netconf_session *session, xmlNode *rpc, xmlNode *node,
-                    int schflags, GList **xml_list, bool *filter_seen, bool *ret)
+config_stream_write (void *context, const char *buffer, int len)
 {
-    char *attr;
-    xmlNode *tnode;
-    GNode *query = NULL;
-    gchar **split;
-    sch_xml_to_gnode_parms parms;
-    sch_node *qschema = NULL;
-    bool is_filter = false;
-    int i;
-    int count;
+    config_stream *stream = (config_stream *) context;
+    int done = 0;
 
-    /* Check the requested datastore */
-    if (g_strcmp0 ((char *) node->name, "source") == 0)
+    /* The descriptor may be a pipe or socket that takes less than asked */
+    while (done < len)
     {
-        xmlNodePtr child = xmlFirstElementChild (node);
-        if (!child || g_strcmp0 ((char *) child->name, "running") != 0)
-        {
-            gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported",
-                                                child ? (char *) child->name : "null");
-            VERBOSE ("%s\n", error_msg);
-            *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
-                                        error_msg, NULL, NULL, true);
-            g_free (error_msg);
+        ssize_t n = write (stream->fd, buffer + done, len - done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
             return -1;
+        done += n;
+    }
+    if (stream->checksum)
+        g_checksum_update (stream->checksum, (const guchar *) buffer, len);
+    stream->bytes += len;
+    return len;
+}
+
+/* Add a query node for s_node below qnode if it holds any configuration.
+ * Nodes that only hold state are left out, as are containers and lists with
+ * nothing to configure */
+static void
+add_config_node (sch_node *s_node, GNode *qnode)
+{
+    GNode *child;
+
+    if (!sch_is_readable (s_node) || sch_is_proxy (s_node))
+        return;
+
+    if (sch_is_leaf_list (s_node))
+    {
+        if (sch_is_writable (s_node))
+        {
+            child = APTERYX_NODE (qnode, sch_name (s_node));
+            APTERYX_NODE (child, g_strdup ("*"));
         }
     }
-    /* Parse any filters */
-    else if (g_strcmp0 ((char *) node->name, "filter") == 0)
+    else if (sch_is_list (s_node))
     {
-        *filter_seen = true;
-        attr = (char *) xmlGetProp (node, BAD_CAST "type");
+        GNode *entry;
 
-        /* Default type is "subtree" */
-        if (attr == NULL)
+        child = APTERYX_NODE (qnode, sch_name (s_node));
+        entry = APTERYX_NODE (child, g_strdup ("*"));
+        for (sch_node *c_node = sch_node_child_first (sch_node_child_first (s_node)); c_node;
+             c_node = sch_node_next_sibling (c_node))
         {
-            attr = g_strdup ("subtree");    /* for the later free */
+            add_config_node (c_node, entry);
         }
-        if (g_strcmp0 (attr, "xpath") == 0)
+        if (!entry->children)
+            apteryx_free_tree (child);
+    }
+    else if (!sch_is_leaf (s_node))
+    {
+        child = APTERYX_NODE (qnode, sch_name (s_node));
+        for (sch_node *c_node = sch_node_child_first (s_node); c_node;
+             c_node = sch_node_next_sibling (c_node))
         {
-            char *schema_path = NULL;
-            char *ns_href = NULL;
-            char *ns_prefix = NULL;
-
-            free (attr);
-            attr = (char *) xmlGetProp (node, BAD_CAST "select");
-            if (!attr)
-            {
-                *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ATTR, NC_ERR_TYPE_PROTOCOL,
-                                            "XPATH filter missing select attribute", "xpath", "select", false);
-                VERBOSE ("XPATH filter missing select attribute");
-                return -1;
-            }
+            add_config_node (c_node, child);
+        }
+        if (!child->children)
+            apteryx_free_tree (child);
+    }
+    else if (sch_is_writable (s_node))
+    {
+        APTERYX_NODE (qnode, sch_name (s_node));
+    }
+}
 
-            VERBOSE ("FILTER: XPATH: %s\n", attr);
-            is_filter = true;
-            split = g_strsplit (attr, "|", -1);
-            count = g_strv_length (split);
-            for (i = 0; i < count; i++)
-            {
-                GString *gpath;
-                char *path;
+/* Write running as a <config> document. Each modelled top level node with any
+ * configuration is queried for just its configuration, serialised straight to
+ * the stream and released before the next, so memory is bounded by the
+ * largest subtree rather than the whole configuration */
+static bool
+config_stream_running (config_stream *stream, const char *base)
+{
+    xmlOutputBuffer *out;
 
-                /* Remove all instances of "child::" */
-                gpath = g_string_new (g_strstrip (split[i]));
-                g_string_replace (gpath, "child::", "", 0);
-                path = g_string_free (gpath, false);
+    /* The buffer writes to the descriptor but leaves it to the caller to close */
+    out = xmlOutputBufferCreateIO (config_stream_write, NULL, stream, NULL);
+    if (!out)
+        return false;
+    xmlOutputBufferWriteString (out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    xmlOutputBufferWriteString (out, "<config xmlns=\"urn:ietf:params:xml:ns:netconf:base:1.0\"");
+    if (base)
+    {
+        xmlOutputBufferWriteString (out, " base=\"");
+        xmlOutputBufferWriteString (out, base);
+        xmlOutputBufferWriteString (out, "\"");
+    }
+    xmlOutputBufferWriteString (out, ">\n");
 
-                qschema = NULL;
-                schflags |= SCH_F_XPATH;
-                xpath_type x_type = XPATH_SIMPLE;
-                if (ns_prefix)
-                {
-                    g_free (ns_prefix);
-                    ns_prefix = NULL;
-                }
-                if (ns_href)
-                {
-                    g_free (ns_href);
-                    ns_href = NULL;
-                }
-                schema_path = check_namespace_set (node, &ns_href, &ns_prefix);
-                if (!ns_href)
-                {
-                    /* Check the get node for a default namespace */
-                    xmlNode *get = xmlFirstElementChild (rpc);
-                    schema_path = check_namespace_set (get, &ns_href, &ns_prefix);
-                }
-                query = sch_xpath_to_gnode (g_schema, NULL, path, schflags | SCH_F_XPATH,
-                                            &qschema, &x_type, schema_path);
-                g_free (schema_path);
+    for (sch_node *s_node = sch_node_child_first (sch_get_root_schema (g_schema)); s_node;
+         s_node = sch_node_next_sibling (s_node))
+    {
+        GNode *query = APTERYX_NODE (NULL, g_strdup ("/"));
+        GNode *tree = NULL;
+        xmlNode *xml = NULL;
 
-                if (x_type == XPATH_ERROR || (!query && x_type == XPATH_SIMPLE))
-                {
-                    VERBOSE ("XPATH: malformed filter\n");
-                    *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MALFORMED_MSG, NC_ERR_TYPE_RPC,
-                                                "XPATH: malformed filter", NULL, NULL, true);
-                    cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
-                    return -1;
-                }
+        add_config_node (s_node, query);
+        if (query->children)
+            tree = apteryx_query (query);
+        apteryx_free_tree (query);
+        if (tree)
+        {
+            xml = sch_gnode_to_xml (g_schema, NULL, tree, SCH_F_CONFIG);
+            apteryx_free_tree (tree);
+        }
+        for (xmlNode *node = xml; node; node = node->next)
+        {
+            xmlNodeDumpOutput (out, NULL, node, 0, 0, NULL);
+            xmlOutputBufferWriteString (out, "\n");
+        }
+        xmlFreeNodeList (xml);
+    }
 
-                if (qschema)
-                {
-                    if (sch_is_leaf (qschema) && !sch_is_readable (qschema))
-                    {
-                        gchar *error_msg = g_strdup_printf ("NETCONF: Path \"%s\" not readable", attr);
-                        VERBOSE ("%s\n", error_msg);
-                        *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_APP,
-                                                    error_msg, NULL, NULL, true);
-                        g_free (error_msg);
-                        apteryx_free_tree (query);
-                        cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
-                        return -1;
-                    }
+    xmlOutputBufferWriteString (out, "</config>\n");
+    return xmlOutputBufferClose (out) >= 0;
+}
 
-                    if (!get_query_schema (session, rpc, query, qschema, path, &ns_href, &ns_prefix,
-                                           x_type, schflags, is_filter, false, xml_list))
-                    {
-                        cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
-                        return -1;
-                    }
-                }
-                else if (!query && x_type == XPATH_EVALUATE)
-                {
-                    if (!get_query_to_xml (session, rpc, query, NULL, 0, path, &ns_href,
-                                           &ns_prefix, x_type, schflags, false, true, xml_list, NULL, 0))
-                    {
-                        cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
-                        return -1;
-                    }
-                }
-                else
-                {
-                    VERBOSE ("XPATH: malformed query\n");
-                    *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MALFORMED_MSG, NC_ERR_TYPE_RPC,
-                                                "XPATH: malformed query", NULL, NULL, true);
-                    cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
-                    return -1;
-                }
-                g_free (path);
-            }
-            g_free (ns_href);
-            g_free (ns_prefix);
-            g_strfreev(split);
+/* Write running to the startup datastore. The file only replaces the startup
+ * datastore once it is safely on disk */
+static bool
+startup_save (const char *base)
+{
+    gchar *tmp_path = g_strdup_printf ("%s.XXXXXX", startup_path);
+    config_stream stream = { -1, NULL, 0 };
+    bool ret = true;
+
+    stream.fd = g_mkstemp (tmp_path);
+    if (stream.fd < 0)
+    {
+        ERROR ("STARTUP: Failed to create \"%s\" (%s)\n", tmp_path, strerror (errno));
+        g_free (tmp_path);
+        return false;
+    }
+
+    if (!config_stream_running (&stream, base))
+    {
+        ERROR ("STARTUP: Failed to write \"%s\"\n", tmp_path);
+        ret = false;
+    }
+    if (ret && fsync (stream.fd) != 0)
+    {
+        ERROR ("STARTUP: Failed to sync \"%s\" (%s)\n", tmp_path, strerror (errno));
+        ret = false;
+    }
+    close (stream.fd);
+    if (ret && rename (tmp_path, startup_path) != 0)
+    {
+        ERROR ("STARTUP: Failed to replace \"%s\" (%s)\n", startup_path, strerror (errno));
+        ret = false;
+    }
+    if (!ret)
+        unlink (tmp_path);
+    g_free (tmp_path);
+    return ret;
+}
+
+/* Remember the config paths changed in running for the next save of startup */
+static void
+startup_journal_record (GList *paths)
+{
+    if (!startup_journal || !paths)
+        return;
+
+    g_mutex_lock (&startup_lock);
+    if (startup_base)
+    {
+        for (GList *iter = paths; iter; iter = g_list_next (iter))
+            g_hash_table_add (startup_dirty, g_strdup ((char *) iter->data));
+        if (g_hash_table_size (startup_dirty) > STARTUP_DIRTY_MAX)
+        {
+            /* Writing a new snapshot will be cheaper */
+            g_free (startup_base);
+            startup_base = NULL;
+            g_hash_table_remove_all (startup_dirty);
         }
-        else if (g_strcmp0 (attr, "subtree") == 0)
+    }
+    g_mutex_unlock (&startup_lock);
+}
+
+/* Records for the current value in running of each path changed since the
+ * last save. Reading the values now rather than as each change is seen means
+ * the journal always ends with what running holds, whatever order the changes
+ * were applied in. A path with no value has been deleted */
+static GString *
+startup_journal_records (void)
+{
+    GString *records = g_string_new (NULL);
+    GList *paths = g_hash_table_get_keys (startup_dirty);
+    GNode *query = APTERYX_NODE (NULL, g_strdup ("/"));
+    GNode *values = NULL;
+
+    paths = g_list_sort (paths, (GCompareFunc) g_strcmp0);
+    for (GList *iter = paths; iter; iter = g_list_next (iter))
+        apteryx_path_to_node (query, (char *) iter->data, NULL);
+    if (query->children)
+        values = apteryx_query (query);
+    apteryx_free_tree (query);
+
+    for (GList *iter = paths; iter; iter = g_list_next (iter))
+    {
+        const char *path = (const char *) iter->data;
+        GNode *node = values ? tree_path_node (values, path, false) : NULL;
+        gchar *epath = g_strescape (path, NULL);
+        gchar *evalue = g_strescape (node && APTERYX_HAS_VALUE (node) ? APTERYX_VALUE (node) : "", NULL);
+
+        g_string_append_printf (records, "%s\t%s\n", epath, evalue);
+        g_free (evalue);
+        g_free (epath);
+    }
+    apteryx_free_tree (values);
+    g_list_free (paths);
+    g_hash_table_remove_all (startup_dirty);
+    return records;
+}
+
+/* Append records to the journal, followed by the commit that makes them part
+ * of startup */
+static bool
+startup_journal_append (GString *records)
+{
+    struct stat st;
+    GString *out;
+    bool ret = true;
+    int fd;
+
+    fd = open (startup_journal, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        ERROR ("STARTUP: Failed to open \"%s\" (%s)\n", startup_journal, strerror (errno));
+        return false;
+    }
+
+    out = g_string_new (NULL);
+    if (fstat (fd, &st) == 0 && st.st_size == 0)
+        g_string_append_printf (out, "base %s\n", startup_base);
+    g_string_append_len (out, records->str, records->len);
+    g_string_append (out, "commit\n");
+    if (write (fd, out->str, out->len) != out->len || fsync (fd) != 0)
+    {
+        ERROR ("STARTUP: Failed to write \"%s\" (%s)\n", startup_journal, strerror (errno));
+        ret = false;
+    }
+    close (fd);
+    g_string_free (out, TRUE);
+    return ret;
+}
+
+/* Write a new snapshot of running, starting a new journal if there is one */
+static bool
+startup_snapshot (void)
+{
+    gchar *base = startup_journal ? g_strdup_printf ("%08x", g_random_int ()) : NULL;
+
+    /* Anything applied from here on is either in the snapshot or recorded after it */
+    g_free (startup_base);
+    startup_base = NULL;
+    if (startup_dirty)
+        g_hash_table_remove_all (startup_dirty);
+
+    if (!startup_save (base))
+    {
+        g_free (base);
+        return false;
+    }
+    if (startup_journal)
+    {
+        unlink (startup_journal);
+        startup_base = base;
+    }
+    return true;
+}
+
+/* Save running to startup. With a journal only the changes since the last save
+ * are written, until the journal outgrows the snapshot and it is compacted into
+ * a new one. Must be called with the startup lock held */
+static bool
+startup_commit (void)
+{
+    struct stat st;
+    off_t snapshot = 0;
+    off_t journal = 0;
+
+    if (startup_journal && startup_base)
+    {
+        GString *records = startup_journal_records ();
+        bool appended;
+
+        if (stat (startup_path, &st) == 0)
+            snapshot = st.st_size;
+        if (stat (startup_journal, &st) == 0)
+            journal = st.st_size;
+        appended = journal + records->len <= MAX (snapshot, STARTUP_JOURNAL_MIN) &&
+                   startup_journal_append (records);
+        g_string_free (records, TRUE);
+        if (appended)
+            return true;
+    }
+    return startup_snapshot ();
+}
+
+/* Getting the response node with netconf is more complicated than restconf as they can have multiple nodes at
+ * some levels. This routine uses the qnode and works upward to guide the tree node as it works from the top down */
+static GNode*
+get_response_node (GNode *tree, int *rdepth, GNode *qnode, sch_node **rschema)
+{
+    GNode *rnode = tree;
+    GNode *child = NULL;
+    int depth = *rdepth;
+
+    while (--depth && rnode)
+    {
+        GNode *children = rnode->children;
+
+        if (children)
         {
-            if (!xmlFirstElementChild (node))
+            GNode *pqnode = qnode;
+            int prdepth = depth;
+            while (pqnode && prdepth > 1)
             {
-                VERBOSE ("SUBTREE: empty query\n");
-                free (attr);
-                *xml_list = g_list_append (*xml_list, NULL);
-                return 0;
+                if (pqnode->parent)
+                    pqnode = pqnode->parent;
+                prdepth--;
             }
 
-            for (tnode = xmlFirstElementChild (node); tnode; tnode = xmlNextElementSibling (tnode))
+            if (g_strcmp0 (APTERYX_NAME (pqnode), "*") == 0)
+                break;
+
+            if (pqnode->parent)
             {
-                qschema = NULL;
-                parms =
-                    sch_xml_to_gnode (g_schema, NULL, tnode, schflags | SCH_F_STRIP_KEY, "merge",
-                                      false, &qschema);
-                query = sch_parm_tree (parms);
-                sch_parm_free (parms);
-                if (!query)
+                for (child = children; child; child = child->next)
                 {
-                    VERBOSE ("SUBTREE: malformed query\n");
-                    *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MALFORMED_MSG, NC_ERR_TYPE_RPC,
-                                                "SUBTREE: malformed query", NULL, NULL, true);
-                    free (attr);
-                    session->counters.in_bad_rpcs++;
-                    netconf_global_stats.session_totals.in_bad_rpcs++;
-                    return -1;
+                    if (g_strcmp0 (APTERYX_NAME (child), APTERYX_NAME (pqnode)) == 0)
+                    {
+                        break;
+                    }
                 }
 
-                if (qschema)
+                /* If the original query response does not have this part of the query
+                 * add it to the response */
+                if (!child)
                 {
-                    if (sch_is_leaf (qschema) && !sch_is_readable (qschema))
-                    {
-                        gchar *error_msg = g_strdup_printf ("NETCONF: Path \"%s\" not readable", attr);
-                        VERBOSE ("%s\n", error_msg);
-                        *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_APP,
-                                                    error_msg, NULL, NULL, true);
-                        g_free (error_msg);
-                        free (attr);
-                        apteryx_free_tree (query);
-                        return -1;
-                    }
-                    if (!get_query_schema (session, rpc, query, qschema, NULL, NULL, NULL, XPATH_NONE,
-                                           schflags, is_filter, true, xml_list))
+                    child = g_node_append_data (rnode, g_strdup (APTERYX_NAME (pqnode)));
+                    char *path = apteryx_node_path(child);
+                    sch_node *snode = sch_lookup (g_schema, path);
+                    if (snode)
                     {
-                        free (attr);
-                        session->counters.in_bad_rpcs++;
-                        netconf_global_stats.session_totals.in_bad_rpcs++;
-                        return -1;
+                        *rschema = snode;
+                        *rdepth = depth + 1;
                     }
+                    g_free (path);
                 }
             }
-        }
-        else
-        {
-            gchar *error_msg = g_strdup_printf ("FILTER: unsupported/missing type (%s)", attr);
-            VERBOSE ("%s\n", error_msg);
-            *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_APP,
-                                        error_msg, NULL, NULL, true);
-            g_free (error_msg);
+            if (child)
+                rnode = child;
+            else
+                rnode = rnode->children;
+        }
+    }
+    return rnode;
+}
+
+static bool
+get_query_to_xml (struct netconf_session *session, xmlNode *rpc, GNode *query,
+                  GNode *qnode, int qdepth, char *path, char **ns_href,
+                  char **ns_prefix, xpath_type x_type, int schflags,
+                  int max_depth, nc_datastore ds, bool is_subtree, bool is_filter,
+                  GList **xml_list, sch_node *rschema, int rdepth)
+{
+    GNode *tree = NULL;
+    xmlNode *xml = NULL;
+    GList *limits = NULL;
+
+    /* Only ask the database for the levels we are going to return */
+    if (query && max_depth)
+        query_replace_wildcards (query, &qnode, max_depth, is_subtree, &limits);
+
+    /* Query database */
+    DEBUG ("NETCONF: GET %s\n", query ? APTERYX_NAME (query) : "/");
+    if (((logging & LOG_GET) && !(schflags & SCH_F_CONFIG)) ||
+        ((logging & LOG_GET_CONFIG) && (schflags & SCH_F_CONFIG)))
+    {
+        GString *qpath = g_string_new ("./");
+        GList *paths = generate_apteryx_query_node_paths (query, qpath, NULL);
+        for (GList *iter = paths; iter; iter = iter->next)
+            NOTICE ("%s: %s@%s id:%u path:%s\n",
+                    (schflags & SCH_F_CONFIG) ? "GET-CONFIG" : "GET",
+                    session->username, session->rem_addr, session->id,
+                    (gchar*) iter->data);
+
+        g_list_free_full (paths, g_free);
+        g_string_free (qpath, TRUE);
+    }
+
+    if (ds == NC_DS_STARTUP)
+    {
+        /* Startup is read from its file rather than the database */
+        if (query || !is_filter)
+            startup_overlay (&tree, query);
+    }
+    else if (query)
+    {
+        if (is_subtree)
+            tree = apteryx_query_full (query);
+        else
+            tree = apteryx_query (query);
+    }
+    else if (!is_filter)
+        tree = max_depth ? get_full_tree_depth (max_depth, &limits) : get_full_tree ();
+
+    /* Containers at the depth limit are reported without their contents */
+    if (limits && ds != NC_DS_STARTUP)
+        depth_limit_add_containers (&tree, limits);
+    g_list_free_full (limits, g_free);
+
+    /* The candidate is running with any uncommitted changes on top */
+    if (ds == NC_DS_CANDIDATE && (query || !is_filter))
+        candidate_overlay (&tree, query);
+
+    if (query && (schflags & SCH_F_ADD_DEFAULTS) && rschema)
+    {
+        GNode *rnode = NULL;
+        if (tree)
+            rnode = get_response_node (tree, &rdepth, qnode, &rschema);
+
+        sch_add_defaults (g_schema, rschema, &tree, &query, rnode, qnode, rdepth,
+                          qdepth, schflags);
+    }
+
+    if (tree && (schflags & SCH_F_TRIM_DEFAULTS) && rschema)
+    {
+        GNode *rnode = get_response_node (tree, &rdepth, qnode, &rschema);
+        sch_traverse_tree (g_schema, rschema, rnode, schflags);
+    }
+
+    apteryx_free_tree (query);
+
+    /* Convert result to XML */
+    xml = tree ? sch_gnode_to_xml (g_schema, NULL, tree, schflags) : NULL;
+    apteryx_free_tree (tree);
+
+    if (xml && x_type == XPATH_EVALUATE)
+        return xpath_evaluate (session, rpc, path, ns_href, ns_prefix, xml, schflags, xml_list);
+    else
+        *xml_list = g_list_append (*xml_list, xml);
+    return true;
+}
+
+static bool
+get_query_schema (struct netconf_session *session, xmlNode *rpc, GNode *query,
+                  sch_node *qschema, char *path, char **ns_href, char **ns_prefix, xpath_type x_type,
+                  int schflags, int max_depth, nc_datastore ds, bool is_filter, bool is_subtree,
+                  GList **xml_list)
+{
+    GNode *qnode = NULL;
+    sch_node *rschema = qschema;
+    int qdepth = 0;
+    int rdepth = 1;
+    int diff;
+
+    /* Get the depth of the response which is the depth of the query
+     * or up until the first path wildcard */
+    qdepth = g_node_max_height (query);
+    qnode = query;
+    if (is_subtree)
+    {
+        q_param qparam = { 0 };
+
+        /* Subtree queries end with a NULL data node or a value node, reduce the depth of the n-ary to compensate */
+        if (is_subtree)
+        {
+            if (qdepth)
+                qdepth--;
+        }
+        g_node_traverse (qnode, G_IN_ORDER, G_TRAVERSE_LEAVES, -1, process_subtree_query_leaves, &qparam);
+        rdepth = qparam.depth;
+
+        if (qparam.deepest_leaf)
+        {
+            qnode = qparam.deepest_leaf;
+            if (g_strcmp0 (APTERYX_NAME (qparam.deepest_leaf), "*") == 0)
+            {
+                if (qdepth == rdepth)
+                    rdepth--;
+                qdepth--;
+                if (qparam.deepest_leaf->parent)
+                    qnode = qparam.deepest_leaf->parent;
+            }
+        }
+
+        if (qparam.deepest_leaf && sch_node_parent (rschema) && sch_is_list (sch_node_parent (rschema)))
+        {
+            /* We need to present the list rather than the key */
+            rschema = sch_node_parent (rschema);
+            if (rschema && qparam.deepest_leaf->parent)
+            {
+                char *s_name = sch_name (rschema);
+                if (qdepth >= rdepth && g_strcmp0 (s_name, APTERYX_NAME(qparam.deepest_leaf->parent)) != 0)
+                {
+                    qdepth--;
+                    rdepth--;
+                    qnode = qparam.deepest_leaf->parent;
+                }
+                g_free (s_name);
+            }
+        }
+
+        diff = qdepth - rdepth;
+        while (diff--)
+            rschema = sch_node_parent (rschema);
+
+        if (qdepth != rdepth && sch_node_parent (rschema) && sch_is_list (sch_node_parent (rschema)))
+        {
+            /* We need to present the list rather than the key */
+            rschema = sch_node_parent (rschema);
+            rdepth--;
+        }
+    }
+    else
+    {
+        while (qnode &&
+                g_node_n_children (qnode) == 1 &&
+                g_strcmp0 (APTERYX_NAME (g_node_first_child (qnode)), "*") != 0)
+        {
+            qnode = g_node_first_child (qnode);
+            rdepth++;
+        }
+
+        diff = qdepth - rdepth;
+        while (diff--)
+            rschema = sch_node_parent (rschema);
+
+        if (sch_node_parent (rschema) && sch_is_list (sch_node_parent (rschema)))
+        {
+            /* We need to present the list rather than the key */
+            rschema = sch_node_parent (rschema);
+            rdepth--;
+        }
+
+        while (qnode && qnode->children)
+            qnode = qnode->children;
+    }
+
+    /* Without a query we may need to add a wildcard to get everything from here down */
+    if (is_filter && qnode && qdepth == g_node_max_height (query) &&
+        !(schflags & SCH_F_DEPTH_ONE))
+    {
+        if (qschema && sch_node_child_first (qschema) && !(schflags & SCH_F_STRIP_DATA))
+        {
+            /* Get everything from here down if we do not already have a star */
+            if (!g_node_first_child (qnode) && g_strcmp0 (APTERYX_NAME (qnode), "*") != 0)
+            {
+                APTERYX_NODE (qnode, g_strdup ("*"));
+                DEBUG ("%*s%s\n", qdepth * 2, " ", "*");
+            }
+        }
+    }
+
+    return get_query_to_xml (session, rpc, query, qnode, qdepth, path, ns_href,
+                             ns_prefix, x_type, schflags, max_depth, ds, is_subtree, true,
+                             xml_list, rschema, rdepth);
+}
+
+static void
+cleanup_on_xpath_error (struct netconf_session *session, char *attr, gchar **split,
+                        char *ns_href, char *ns_prefix, char *path)
+{
+    free (attr);
+    g_strfreev(split);
+    g_free (ns_href);
+    g_free (ns_prefix);
+    g_free (path);
+    session->counters.in_bad_rpcs++;
+    netconf_global_stats.session_totals.in_bad_rpcs++;
+}
+
+static int
+get_process_action (struct netconf_session *session, xmlNode *rpc, xmlNode *node,
+                    int schflags, int max_depth, nc_datastore ds, GList **xml_list,
+                    bool *filter_seen, bool *ret)
+{
+    char *attr;
+    xmlNode *tnode;
+    GNode *query = NULL;
+    gchar **split;
+    sch_xml_to_gnode_parms parms;
+    sch_node *qschema = NULL;
+    bool is_filter = false;
+    int i;
+    int count;
+
+    /* Parse any filters */
+    if (g_strcmp0 ((char *) node->name, "filter") == 0)
+    {
+        *filter_seen = true;
+        attr = (char *) xmlGetProp (node, BAD_CAST "type");
+
+        /* Default type is "subtree" */
+        if (attr == NULL)
+        {
+            attr = g_strdup ("subtree");    /* for the later free */
+        }
+        if (g_strcmp0 (attr, "xpath") == 0)
+        {
+            char *schema_path = NULL;
+            char *ns_href = NULL;
+            char *ns_prefix = NULL;
+
             free (attr);
-            return -1;
+            attr = (char *) xmlGetProp (node, BAD_CAST "select");
+            if (!attr)
+            {
+                *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ATTR, NC_ERR_TYPE_PROTOCOL,
+                                            "XPATH filter missing select attribute", "xpath", "select", false);
+                VERBOSE ("XPATH filter missing select attribute");
+                return -1;
+            }
+
+            VERBOSE ("FILTER: XPATH: %s\n", attr);
+            is_filter = true;
+            split = g_strsplit (attr, "|", -1);
+            count = g_strv_length (split);
+            for (i = 0; i < count; i++)
+            {
+                GString *gpath;
+                char *path;
+
+                /* Remove all instances of "child::" */
+                gpath = g_string_new (g_strstrip (split[i]));
+                g_string_replace (gpath, "child::", "", 0);
+                path = g_string_free (gpath, false);
+
+                qschema = NULL;
+                schflags |= SCH_F_XPATH;
+                xpath_type x_type = XPATH_SIMPLE;
+                if (ns_prefix)
+                {
+                    g_free (ns_prefix);
+                    ns_prefix = NULL;
+                }
+                if (ns_href)
+                {
+                    g_free (ns_href);
+                    ns_href = NULL;
+                }
+                schema_path = check_namespace_set (node, &ns_href, &ns_prefix);
+                if (!ns_href)
+                {
+                    /* Check the get node for a default namespace */
+                    xmlNode *get = xmlFirstElementChild (rpc);
+                    schema_path = check_namespace_set (get, &ns_href, &ns_prefix);
+                }
+                query = sch_xpath_to_gnode (g_schema, NULL, path, schflags | SCH_F_XPATH,
+                                            &qschema, &x_type, schema_path);
+                g_free (schema_path);
+
+                if (x_type == XPATH_ERROR || (!query && x_type == XPATH_SIMPLE))
+                {
+                    VERBOSE ("XPATH: malformed filter\n");
+                    *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MALFORMED_MSG, NC_ERR_TYPE_RPC,
+                                                "XPATH: malformed filter", NULL, NULL, true);
+                    cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
+                    return -1;
+                }
+
+                if (qschema)
+                {
+                    if (sch_is_leaf (qschema) && !sch_is_readable (qschema))
+                    {
+                        gchar *error_msg = g_strdup_printf ("NETCONF: Path \"%s\" not readable", attr);
+                        VERBOSE ("%s\n", error_msg);
+                        *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_APP,
+                                                    error_msg, NULL, NULL, true);
+                        g_free (error_msg);
+                        apteryx_free_tree (query);
+                        cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
+                        return -1;
+                    }
+
+                    if (!get_query_schema (session, rpc, query, qschema, path, &ns_href, &ns_prefix,
+                                           x_type, schflags, max_depth, ds, is_filter, false, xml_list))
+                    {
+                        cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
+                        return -1;
+                    }
+                }
+                else if (!query && x_type == XPATH_EVALUATE)
+                {
+                    if (!get_query_to_xml (session, rpc, query, NULL, 0, path, &ns_href,
+                                           &ns_prefix, x_type, schflags, max_depth, ds, false, true,
+                                           xml_list, NULL, 0))
+                    {
+                        cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
+                        return -1;
+                    }
+                }
+                else
+                {
+                    VERBOSE ("XPATH: malformed query\n");
+                    *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MALFORMED_MSG, NC_ERR_TYPE_RPC,
+                                                "XPATH: malformed query", NULL, NULL, true);
+                    cleanup_on_xpath_error (session, attr, split, ns_href, ns_prefix, path);
+                    return -1;
+                }
+                g_free (path);
+            }
+            g_free (ns_href);
+            g_free (ns_prefix);
+            g_strfreev(split);
+        }
+        else if (g_strcmp0 (attr, "subtree") == 0)
+        {
+            if (!xmlFirstElementChild (node))
+            {
+                VERBOSE ("SUBTREE: empty query\n");
+                free (attr);
+                *xml_list = g_list_append (*xml_list, NULL);
+                return 0;
+            }
+
+            for (tnode = xmlFirstElementChild (node); tnode; tnode = xmlNextElementSibling (tnode))
+            {
+                qschema = NULL;
+                parms =
+                    sch_xml_to_gnode (g_schema, NULL, tnode, schflags | SCH_F_STRIP_KEY, NC_OP_MERGE,
+                                      false, false, &qschema);
+                query = sch_parm_tree (parms);
+                sch_parm_free (parms);
+                if (!query)
+                {
+                    VERBOSE ("SUBTREE: malformed query\n");
+                    *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MALFORMED_MSG, NC_ERR_TYPE_RPC,
+                                                "SUBTREE: malformed query", NULL, NULL, true);
+                    free (attr);
+                    session->counters.in_bad_rpcs++;
+                    netconf_global_stats.session_totals.in_bad_rpcs++;
+                    return -1;
+                }
+
+                if (qschema)
+                {
+                    if (sch_is_leaf (qschema) && !sch_is_readable (qschema))
+                    {
+                        gchar *error_msg = g_strdup_printf ("NETCONF: Path \"%s\" not readable", attr);
+                        VERBOSE ("%s\n", error_msg);
+                        *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_APP,
+                                                    error_msg, NULL, NULL, true);
+                        g_free (error_msg);
+                        free (attr);
+                        apteryx_free_tree (query);
+                        return -1;
+                    }
+                    if (!get_query_schema (session, rpc, query, qschema, NULL, NULL, NULL, XPATH_NONE,
+                                           schflags, max_depth, ds, is_filter, true, xml_list))
+                    {
+                        free (attr);
+                        session->counters.in_bad_rpcs++;
+                        netconf_global_stats.session_totals.in_bad_rpcs++;
+                        return -1;
+                    }
+                }
+            }
+        }
+        else
+        {
+            gchar *error_msg = g_strdup_printf ("FILTER: unsupported/missing type (%s)", attr);
+            VERBOSE ("%s\n", error_msg);
+            *ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_APP,
+                                        error_msg, NULL, NULL, true);
+            g_free (error_msg);
+            free (attr);
+            return -1;
+        }
+        free (attr);
+    }
+
+    return 0;
+}
+
+/* Top level subtree name of a path or element name, ignoring any prefix so
+ * that all namespaces sharing a root share a counter */
+static char *
+generation_root_name (const char *path)
+{
+    const char *colon;
+    size_t len;
+
+    while (*path == '/')
+        path++;
+    len = strcspn (path, "/[");
+    if (len == 0)
+        return NULL;
+    colon = memchr (path, ':', len);
+    if (colon)
+    {
+        len -= (colon + 1 - path);
+        path = colon + 1;
+    }
+    return g_strndup (path, len);
+}
+
+/* Record a change to path. Must be called with the generation lock held */
+static void
+generation_record (const char *path)
+{
+    char *root = generation_root_name (path);
+    journal_entry *entry;
+    guint64 *gen;
+
+    running_generation++;
+    if (root)
+    {
+        gen = g_hash_table_lookup (generation_table, root);
+        if (!gen)
+        {
+            gen = g_new0 (guint64, 1);
+            g_hash_table_insert (generation_table, root, gen);
+            root = NULL;
+        }
+        *gen = running_generation;
+    }
+    g_free (root);
+
+    /* Overwrite the oldest journal entry once full */
+    entry = &change_journal[journal_count % NETCONF_JOURNAL_SIZE];
+    if (entry->path)
+    {
+        journal_evicted_seq = entry->seq;
+        g_free (entry->path);
+    }
+    entry->seq = running_generation;
+    entry->path = g_strdup (path);
+    journal_count++;
+}
+
+/* Config leaves in a change tree, with the value of each */
+typedef struct _generation_changes
+{
+    GList *paths;
+    GList *values;
+} generation_changes;
+
+/* Collect the path and value of a changed leaf if it is configuration. State
+ * is not part of the running datastore so it changes neither entity tags,
+ * get-changes nor startup */
+static gboolean
+generation_config_leaf (GNode *node, gpointer data)
+{
+    generation_changes *changes = (generation_changes *) data;
+
+    if (node->parent)
+    {
+        char *path = apteryx_node_path (node->parent);
+        sch_node *schema = sch_lookup (g_schema, path);
+
+        if (schema && sch_is_writable (schema))
+        {
+            changes->paths = g_list_prepend (changes->paths, path);
+            changes->values = g_list_prepend (changes->values, APTERYX_NAME (node));
+        }
+        else
+            g_free (path);
+    }
+    return FALSE;
+}
+
+static void
+generation_applied_free (GQueue *values)
+{
+    g_queue_free_full (values, g_free);
+}
+
+/* Remember a value set by NETCONF. Must be called with the generation lock held */
+static void
+generation_applied_add (const char *path, const char *value)
+{
+    GQueue *values = g_hash_table_lookup (generation_applied, path);
+
+    if (!values)
+    {
+        if (g_hash_table_size (generation_applied) >= GENERATION_APPLIED_MAX)
+            g_hash_table_remove_all (generation_applied);
+        values = g_queue_new ();
+        g_hash_table_insert (generation_applied, g_strdup (path), values);
+    }
+    g_queue_push_tail (values, g_strdup (value));
+}
+
+/* Check if the watch is seeing a value set by NETCONF, which has already been
+ * recorded. Values queued before it were overwritten before the watch saw
+ * them, and a value that was not queued means running was changed elsewhere,
+ * so either way the queue is done with. Must be called with the generation
+ * lock held */
+static bool
+generation_applied_take (const char *path, const char *value)
+{
+    GQueue *values = g_hash_table_lookup (generation_applied, path);
+    bool found = false;
+
+    if (!values)
+        return false;
+    while (!found && !g_queue_is_empty (values))
+    {
+        char *applied = g_queue_pop_head (values);
+        found = g_strcmp0 (applied, value) == 0;
+        g_free (applied);
+    }
+    if (g_queue_is_empty (values))
+        g_hash_table_remove (generation_applied, path);
+    return found;
+}
+
+/* Changes to running made outside NETCONF are recorded here */
+static bool
+_netconf_generation_watch (GNode *root)
+{
+    generation_changes changes = { NULL, NULL };
+    GList *paths = NULL;
+    GList *piter, *viter;
+
+    g_node_traverse (root, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1, generation_config_leaf, &changes);
+    changes.paths = g_list_reverse (changes.paths);
+    changes.values = g_list_reverse (changes.values);
+    g_mutex_lock (&generation_lock);
+    for (piter = changes.paths, viter = changes.values; piter;
+         piter = g_list_next (piter), viter = g_list_next (viter))
+    {
+        if (generation_applied_take ((char *) piter->data, (char *) viter->data))
+            continue;
+        generation_record ((char *) piter->data);
+        paths = g_list_prepend (paths, piter->data);
+    }
+    g_mutex_unlock (&generation_lock);
+    startup_journal_record (paths);
+    g_list_free (paths);
+    g_list_free_full (changes.paths, g_free);
+    g_list_free (changes.values);
+    apteryx_free_tree (root);
+    return true;
+}
+
+/* Apply a change to running and record it as the change is made, so a
+ * following get-config or get-changes reflects it without waiting for the
+ * watches. The generation lock is held over the set so the watch only sees
+ * the change once it is known to come from NETCONF */
+static bool
+running_set_tree (GNode *tree)
+{
+    generation_changes changes = { NULL, NULL };
+    GList *piter, *viter;
+    bool ret;
+
+    g_node_traverse (tree, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1, generation_config_leaf, &changes);
+    changes.paths = g_list_reverse (changes.paths);
+    changes.values = g_list_reverse (changes.values);
+    g_mutex_lock (&generation_lock);
+    ret = apteryx_set_tree_full (tree, UINT64_MAX, false);
+    for (piter = changes.paths, viter = changes.values; ret && piter;
+         piter = g_list_next (piter), viter = g_list_next (viter))
+    {
+        generation_record ((char *) piter->data);
+        generation_applied_add ((char *) piter->data, (char *) viter->data);
+    }
+    g_mutex_unlock (&generation_lock);
+    if (ret)
+        startup_journal_record (changes.paths);
+    g_list_free_full (changes.paths, g_free);
+    g_list_free (changes.values);
+    return ret;
+}
+
+static gchar *
+generation_token (guint64 seq)
+{
+    return g_strdup_printf ("%08x-%" G_GUINT64_FORMAT, generation_nonce, seq);
+}
+
+static bool
+generation_token_parse (const char *token, guint64 *seq)
+{
+    char *end = NULL;
+
+    if (!token || strtoul (token, &end, 16) != generation_nonce || *end != '-')
+        return false;
+    *seq = g_ascii_strtoull (end + 1, &end, 10);
+    return *end == '\0';
+}
+
+/* Work out which top level subtrees a get-config may return. Returns false
+ * if this cannot be determined from the request alone */
+static bool
+generation_request_roots (xmlNode *action, GList **roots)
+{
+    xmlNode *node;
+    bool ret = true;
+
+    for (node = xmlFirstElementChild (action); node && ret; node = xmlNextElementSibling (node))
+    {
+        char *type;
+
+        if (g_strcmp0 ((char *) node->name, "filter") != 0)
+            continue;
+
+        type = (char *) xmlGetProp (node, BAD_CAST "type");
+        if (!type || g_strcmp0 (type, "subtree") == 0)
+        {
+            for (xmlNode *tnode = xmlFirstElementChild (node); tnode; tnode = xmlNextElementSibling (tnode))
+                *roots = g_list_prepend (*roots, g_strdup ((char *) tnode->name));
+        }
+        else if (g_strcmp0 (type, "xpath") == 0)
+        {
+            char *select = (char *) xmlGetProp (node, BAD_CAST "select");
+            gchar **split = select ? g_strsplit (select, "|", -1) : NULL;
+
+            for (int i = 0; split && split[i] && ret; i++)
+            {
+                char *path = g_strstrip (split[i]);
+                char *root;
+
+                if (g_str_has_prefix (path, "child::"))
+                    path += strlen ("child::");
+                if (path[0] != '/' || path[1] == '/' || !(root = generation_root_name (path)))
+                {
+                    ret = false;
+                    break;
+                }
+                if (strchr (root, '*'))
+                {
+                    g_free (root);
+                    ret = false;
+                    break;
+                }
+                *roots = g_list_prepend (*roots, root);
+            }
+            if (!split)
+                ret = false;
+            g_strfreev (split);
+            free (select);
+        }
+        else
+            ret = false;
+        free (type);
+    }
+    return ret && *roots;
+}
+
+/* Entity tag for the running datastore or a set of its top level subtrees.
+ * Counters only increase so the sum changes whenever any of them do */
+static gchar *
+generation_etag (GList *roots)
+{
+    guint64 sum = 0;
+
+    g_mutex_lock (&generation_lock);
+    if (!roots)
+    {
+        sum = running_generation;
+    }
+    for (GList *iter = roots; iter; iter = g_list_next (iter))
+    {
+        char *root = generation_root_name ((char *) iter->data);
+        guint64 *gen = root ? g_hash_table_lookup (generation_table, root) : NULL;
+        if (gen)
+            sum += *gen;
+        g_free (root);
+    }
+    g_mutex_unlock (&generation_lock);
+    return generation_token (sum);
+}
+
+/* Find the lock for a target datastore, NULL if the datastore is not supported */
+static struct ds_lock *
+target_ds_lock (xmlNode *target)
+{
+    if (!target)
+        return NULL;
+    if (xmlStrcmp (target->name, BAD_CAST "running") == 0)
+        return &running_ds_lock;
+    if (xmlStrcmp (target->name, BAD_CAST "candidate") == 0)
+        return &candidate_ds_lock;
+    if (startup_path && xmlStrcmp (target->name, BAD_CAST "startup") == 0)
+        return &startup_ds_lock;
+    return NULL;
+}
+
+/* The datastore a lock protects */
+static nc_datastore
+lock_datastore (struct ds_lock *lock)
+{
+    if (lock == &candidate_ds_lock)
+        return NC_DS_CANDIDATE;
+    if (lock == &startup_ds_lock)
+        return NC_DS_STARTUP;
+    return NC_DS_RUNNING;
+}
+
+static bool
+handle_get (struct netconf_session *session, xmlNode * rpc, gboolean config_only)
+{
+    xmlNode *action = xmlFirstElementChild (rpc);
+    xmlNode *node;
+    GList *xml_list = NULL;
+    GList *list;
+    char *if_none_match = NULL;
+    gchar *etag = NULL;
+    struct ds_lock *lock = &running_ds_lock;
+    nc_datastore ds = NC_DS_RUNNING;
+    int schflags = 0;
+    int max_depth = 0;
+    bool filter_seen = false;
+    bool ret = false;
+
+    if (apteryx_netconf_verbose)
+        schflags |= SCH_F_DEBUG;
+
+    if (config_only)
+    {
+        schflags |= SCH_F_CONFIG;
+    }
+
+    /* Parse options - first look for the datastore, with-defaults and max-depth options as these change the way query lookup works */
+    for (node = xmlFirstElementChild (action); node; node = xmlNextElementSibling (node))
+    {
+        if (g_strcmp0 ((char *) node->name, "source") == 0)
+        {
+            xmlNodePtr child = xmlFirstElementChild (node);
+
+            lock = target_ds_lock (child);
+            if (!lock)
+            {
+                gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported",
+                                                    child ? (char *) child->name : "null");
+                VERBOSE ("%s\n", error_msg);
+                ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
+                                           error_msg, NULL, NULL, true);
+                g_free (error_msg);
+                free (if_none_match);
+                return ret;
+            }
+            ds = lock_datastore (lock);
+        }
+        else if (g_strcmp0 ((char *) node->name, "max-depth") == 0)
+        {
+            char *depth = (char *) xmlNodeGetContent (node);
+            char *end = NULL;
+            long value = 0;
+
+            if (depth && g_strcmp0 (depth, "unbounded") != 0)
+            {
+                value = strtol (depth, &end, 10);
+                if (end == depth || *end != '\0' || value < 1 || value > 65535)
+                {
+                    gchar *error_msg = g_strdup_printf ("MAX-DEPTH: Invalid value \"%s\"", depth);
+                    VERBOSE ("%s\n", error_msg);
+                    ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                                               error_msg, "max-depth", NULL, false);
+                    g_free (error_msg);
+                    free (depth);
+                    free (if_none_match);
+                    session->counters.in_bad_rpcs++;
+                    netconf_global_stats.session_totals.in_bad_rpcs++;
+                    return ret;
+                }
+            }
+            max_depth = (int) value;
+            free (depth);
+        }
+        else if (g_strcmp0 ((char *) node->name, "if-none-match") == 0)
+        {
+            free (if_none_match);
+            if_none_match = (char *) xmlNodeGetContent (node);
+        }
+        else if (g_strcmp0 ((char *) node->name, "with-defaults") == 0)
+        {
+            char *defaults_type = (char *) xmlNodeGetContent (node);
+            if (g_strcmp0 (defaults_type, "report-all") == 0)
+            {
+                schflags |= SCH_F_ADD_DEFAULTS;
+            }
+            else if (g_strcmp0 (defaults_type, "trim") == 0)
+            {
+                schflags |= SCH_F_TRIM_DEFAULTS;
+            }
+            else if (g_strcmp0 (defaults_type, "explicit") != 0)
+            {
+                gchar *error_msg = g_strdup_printf ("WITH-DEFAULTS: No support for with-defaults query type \"%s\"",
+                                                    defaults_type);
+                ERROR ("%s\n", error_msg);
+                ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
+                                           error_msg, NULL, NULL, true);
+                g_free (error_msg);
+                free (defaults_type);
+                free (if_none_match);
+                return ret;
+            }
+            free (defaults_type);
+        }
+    }
+
+    /* Validate lock if configured on the datastore */
+    if (lock->locked == TRUE && (session->id != lock->nc_sess.id))
+    {
+        /* A lock is already held by another NETCONF session, return lock-denied */
+        VERBOSE ("Lock failed, lock is already held\n");
+        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
+                                   "Lock is already held", NULL, NULL, false);
+        free (if_none_match);
+        return ret;
+    }
+
+    /* Configuration changes to running are tracked so get-config replies can be
+     * tagged, and an unchanged tag answered without querying anything */
+    if (config_only && ds == NC_DS_RUNNING)
+    {
+        GList *roots = NULL;
+
+        etag = generation_etag (generation_request_roots (action, &roots) ? roots : NULL);
+        g_list_free_full (roots, g_free);
+        if (if_none_match && g_strcmp0 (g_strstrip (if_none_match), etag) == 0)
+        {
+            VERBOSE ("GET-CONFIG: not modified (%s)\n", etag);
+            ret = send_rpc_data (session, rpc, NULL, etag, true);
+            session->counters.in_rpcs++;
+            netconf_global_stats.session_totals.in_rpcs++;
+            g_free (etag);
+            free (if_none_match);
+            return ret;
+        }
+    }
+    free (if_none_match);
+
+    /* Parse the remaining options */
+    for (node = xmlFirstElementChild (action); node; node = xmlNextElementSibling (node))
+    {
+        if (g_strcmp0 ((char *) node->name, "source") == 0 ||
+            g_strcmp0 ((char *) node->name, "with-defaults") == 0 ||
+            g_strcmp0 ((char *) node->name, "max-depth") == 0 ||
+            g_strcmp0 ((char *) node->name, "if-none-match") == 0)
+            continue;
+
+        if (get_process_action (session, rpc, node, schflags, max_depth, ds, &xml_list,
+                                &filter_seen, &ret) < 0)
+        {
+            /* Cleanup any requests added to the xml_list before hitting an error */
+            for (list = g_list_first (xml_list); list; list = g_list_next (list))
+            {
+                xmlFree (list->data);
+            }
+            g_list_free (xml_list);
+            g_free (etag);
+
+            return ret;
+        }
+    }
+
+    /* Catch for get without filter */
+    if (!filter_seen && !xml_list)
+    {
+        if (!get_query_to_xml (session, rpc, NULL, NULL, 0, NULL, NULL, NULL,
+                               XPATH_NONE, schflags, max_depth, ds, false, false, &xml_list,
+                               NULL, 0))
+        {
+            session->counters.in_bad_rpcs++;
+            netconf_global_stats.session_totals.in_bad_rpcs++;
+            g_free (etag);
+            return false;
+        }
+    }
+
+    /* Send response */
+    send_rpc_data (session, rpc, xml_list, etag, false);
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    g_free (etag);
+
+    return true;
+}
+
+static xmlNode *
+xmlFindNodeByName (xmlNode * root, const xmlChar * name)
+{
+    xmlNode *child;
+
+    for (child = xmlFirstElementChild (root); child; child = xmlNextElementSibling (child))
+    {
+        if (!xmlStrcmp (child->name, name))
+        {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+static bool
+tree_has_path (GNode *tree, const char *path)
+{
+    gchar **parts = g_strsplit (path + 1, "/", -1);
+    GNode *node = tree;
+
+    for (int i = 0; node && parts[i]; i++)
+        node = apteryx_find_child (node, parts[i]);
+    g_strfreev (parts);
+    return node != NULL;
+}
+
+static gboolean
+find_set_value (GNode *node, gpointer data)
+{
+    if (node->parent && node->data && ((char *) node->data)[0] != '\0')
+    {
+        *(bool *) data = true;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* True if there is a value other than "" at or below path */
+static bool
+tree_has_data (GNode *tree, const char *path)
+{
+    GNode *node = tree ? tree_path_node (tree, path, false) : NULL;
+    bool found = false;
+
+    if (node)
+        g_node_traverse (node, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1, find_set_value, &found);
+    return found;
+}
+
+/* True if the candidate has anything staged at or below path. Those paths
+ * need their staged changes laid over what running holds */
+static bool
+candidate_touches (const char *path)
+{
+    bool found = false;
+
+    g_mutex_lock (&candidate_data_lock);
+    for (GList *iter = candidate_roots; iter && !found; iter = g_list_next (iter))
+        found = tree_path_node ((GNode *) iter->data, path, false) != NULL;
+    g_mutex_unlock (&candidate_data_lock);
+    return found;
+}
+
+/* Add the cheapest query that shows whether data exists at path. A leaf is
+ * fetched, a list entry by its first key leaf, and anything the key does not
+ * show is left to a single level search of the path afterwards. Only paths
+ * with candidate changes staged below them are fetched in full */
+static void
+_exist_query_add (GNode *query, const char *path, nc_datastore ds)
+{
+    sch_node *schema = sch_lookup (g_schema, path);
+    char *probe = NULL;
+
+    if (schema && sch_is_leaf (schema))
+    {
+        probe = g_strdup (path);
+    }
+    else if (ds == NC_DS_CANDIDATE && candidate_touches (path))
+    {
+        probe = g_strdup_printf ("%s/*", path);
+    }
+    else if (schema && sch_node_parent (schema) && sch_is_list (sch_node_parent (schema)))
+    {
+        GList *keys = sch_list_keys (sch_node_parent (schema));
+        if (keys)
+            probe = g_strdup_printf ("%s/%s", path, (char *) keys->data);
+        g_list_free_full (keys, g_free);
+    }
+    if (probe)
+        apteryx_path_to_node (query, probe, NULL);
+    g_free (probe);
+}
+
+/* True if data exists at path, from the existence query or failing that a
+ * search of the level below path */
+static bool
+_exist_check (GNode *tree, const char *path, nc_datastore ds)
+{
+    sch_node *schema;
+    gchar *search;
+    GList *children;
+
+    if (tree_has_data (tree, path))
+        return true;
+    schema = sch_lookup (g_schema, path);
+    if ((schema && sch_is_leaf (schema)) || (ds == NC_DS_CANDIDATE && candidate_touches (path)))
+        return false;
+
+    search = g_strdup_printf ("%s/", path);
+    children = apteryx_search (search);
+    g_free (search);
+    g_list_free_full (children, free);
+    return children != NULL;
+}
+
+/**
+ * Check for existence of data at each delete and create path with a single
+ * query. This is required for NC_OP_CREATE and NC_OP_DELETE. Deletes must
+ * exist and creates must not. When checking the candidate, its uncommitted
+ * changes are laid over the query result. Returns the first path that does
+ * not match, filling in err_tag, or NULL if all paths are as expected. If
+ * failed is given an error is added to it for every path that does not match.
+ */
+static const char *
+_check_exist (GList *deletes, GList *creates, nc_datastore ds, NC_ERR_TAG *err_tag, GList **failed)
+{
+    GNode *query;
+    GNode *tree = NULL;
+    GList *iter;
+    const char *bad = NULL;
+
+    if (!deletes && !creates)
+        return NULL;
+
+    query = APTERYX_NODE (NULL, g_strdup ("/"));
+    for (iter = deletes; iter; iter = g_list_next (iter))
+        _exist_query_add (query, (char *) iter->data, ds);
+    for (iter = creates; iter; iter = g_list_next (iter))
+        _exist_query_add (query, (char *) iter->data, ds);
+    tree = query->children ? apteryx_query (query) : NULL;
+    if (ds == NC_DS_CANDIDATE)
+        candidate_overlay (&tree, NULL);
+    apteryx_free_tree (query);
+
+    for (iter = deletes; iter && (!bad || failed); iter = g_list_next (iter))
+    {
+        if (!_exist_check (tree, (char *) iter->data, ds))
+        {
+            if (!bad)
+            {
+                *err_tag = NC_ERR_TAG_DATA_MISSING;
+                bad = (char *) iter->data;
+            }
+            if (failed)
+                *failed = g_list_append (*failed, _new_error_parms (NC_ERR_TAG_DATA_MISSING, NC_ERR_TYPE_APP,
+                                                                    (char *) iter->data));
+        }
+    }
+    for (iter = creates; iter && (!bad || failed); iter = g_list_next (iter))
+    {
+        if (_exist_check (tree, (char *) iter->data, ds))
+        {
+            if (!bad)
+            {
+                *err_tag = NC_ERR_TAG_DATA_EXISTS;
+                bad = (char *) iter->data;
+            }
+            if (failed)
+                *failed = g_list_append (*failed, _new_error_parms (NC_ERR_TAG_DATA_EXISTS, NC_ERR_TYPE_APP,
+                                                                    (char *) iter->data));
+        }
+    }
+    apteryx_free_tree (tree);
+    return bad;
+}
+
+/**
+ * Process the default-operation option in an edit element, returning whether the
+ * edit_config processing can continue. The other return via passed in pointers is
+ * the default operation
+ */
+static bool
+_handle_default_operation (xmlNode *action, nc_operation *def_op_pt)
+{
+    xmlNode *def_op_node;
+    xmlChar *def_op_content;
+    bool def_op_inv_value = false;
+
+    /* Find the default-operation parameter, if not there, just return with def_op set to "merge" */
+    def_op_node = xmlFindNodeByName (action, BAD_CAST "default-operation");
+    if (!def_op_node)
+    {
+        *def_op_pt = NC_OP_MERGE;
+        return true;
+    }
+
+    /* Check the parameter contents. */
+    def_op_content = xmlNodeGetContent (def_op_node);
+    if (def_op_content)
+    {
+        if (g_strcmp0 ((char *) def_op_content, "merge") == 0)
+        {
+            *def_op_pt = NC_OP_MERGE;
+        }
+        else if (g_strcmp0 ((char *) def_op_content, "replace") == 0)
+        {
+            *def_op_pt = NC_OP_REPLACE;
+        }
+        else if (g_strcmp0 ((char *) def_op_content, "none") == 0)
+        {
+            *def_op_pt = NC_OP_NONE;
+        }
+        else
+        {
+            def_op_inv_value = true;
+        }
+        xmlFree (def_op_content);
+    }
+    else
+    {
+        def_op_inv_value = true;
+    }
+
+    /* If contents are invalid, send RPC error */
+    if (def_op_inv_value)
+    {
+        return false;
+    }
+    return true;
+}
+
+/* Find the test-option parameter, test-then-set if not there */
+static bool
+_handle_test_option (xmlNode *action, nc_test_option *test_opt_pt)
+{
+    xmlNode *test_opt_node;
+    xmlChar *test_opt_content;
+    bool ret = true;
+
+    *test_opt_pt = NC_TEST_THEN_SET;
+    test_opt_node = xmlFindNodeByName (action, BAD_CAST "test-option");
+    if (!test_opt_node)
+        return true;
+
+    test_opt_content = xmlNodeGetContent (test_opt_node);
+    if (g_strcmp0 ((char *) test_opt_content, "test-then-set") == 0)
+        *test_opt_pt = NC_TEST_THEN_SET;
+    else if (g_strcmp0 ((char *) test_opt_content, "set") == 0)
+        *test_opt_pt = NC_TEST_SET;
+    else if (g_strcmp0 ((char *) test_opt_content, "test-only") == 0)
+        *test_opt_pt = NC_TEST_ONLY;
+    else
+        ret = false;
+    xmlFree (test_opt_content);
+    return ret;
+}
+
+/* Find the error-option parameter, stop-on-error if not there */
+static bool
+_handle_error_option (xmlNode *action, nc_error_option *error_opt_pt)
+{
+    xmlNode *error_opt_node;
+    xmlChar *error_opt_content;
+    bool ret = true;
+
+    *error_opt_pt = NC_ERROR_STOP;
+    error_opt_node = xmlFindNodeByName (action, BAD_CAST "error-option");
+    if (!error_opt_node)
+        return true;
+
+    error_opt_content = xmlNodeGetContent (error_opt_node);
+    if (g_strcmp0 ((char *) error_opt_content, "stop-on-error") == 0)
+        *error_opt_pt = NC_ERROR_STOP;
+    else if (g_strcmp0 ((char *) error_opt_content, "continue-on-error") == 0)
+        *error_opt_pt = NC_ERROR_CONTINUE;
+    else if (g_strcmp0 ((char *) error_opt_content, "rollback-on-error") == 0)
+        *error_opt_pt = NC_ERROR_ROLLBACK;
+    else
+        ret = false;
+    xmlFree (error_opt_content);
+    return ret;
+}
+
+static char *
+split_path_value (char *path)
+{
+    char *value = strrchr (path, '/');
+    if (value)
+    {
+        *value = '\0';
+        value++;
+    }
+    if (!value || strlen (value) == 0)
+    {
+        value = "";
+    }
+    return value;
+}
+
+/* Mark an existing value for deletion, remembering what it was */
+static gboolean
+clear_leaf_value (GNode *node, gpointer data)
+{
+    GHashTable *old_values = (GHashTable *) data;
+
+    if (node->parent)
+    {
+        g_hash_table_insert (old_values, node, node->data);
+        node->data = g_strdup ("");
+    }
+    return FALSE;
+}
+
+/* Merge src into dst, moving nodes across and replacing any values in dst.
+ * Leaves being set back to the value they already had are added to unchanged */
+static void
+merge_change_tree (GNode *dst, GNode *src, GHashTable *old_values, GList **unchanged)
+{
+    GNode *child = src->children;
+
+    if (APTERYX_HAS_VALUE (src))
+    {
+        const char *old = dst->children ? g_hash_table_lookup (old_values, dst->children) : NULL;
+
+        if (old && g_strcmp0 (old, APTERYX_VALUE (src)) == 0)
+        {
+            *unchanged = g_list_prepend (*unchanged, dst);
+            return;
+        }
+        while (dst->children)
+        {
+            g_hash_table_remove (old_values, dst->children);
+            apteryx_free_tree (dst->children);
+        }
+        g_node_unlink (child);
+        g_node_append (dst, child);
+        return;
+    }
+
+    while (child)
+    {
+        GNode *next = child->next;
+        GNode *match = apteryx_find_child (dst, APTERYX_NAME (child));
+
+        if (match)
+        {
+            merge_change_tree (match, child, old_values, unchanged);
+        }
+        else
+        {
+            g_node_unlink (child);
+            g_node_append (dst, child);
+        }
+        child = next;
+    }
+}
+
+/* Drop a leaf from the change along with any branches left empty */
+static void
+drop_change_leaf (GNode *root, GNode *leaf)
+{
+    GNode *parent = leaf->parent;
+
+    apteryx_free_tree (leaf);
+    while (parent && parent != root && !parent->children)
+    {
+        GNode *next = parent->parent;
+        apteryx_free_tree (parent);
+        parent = next;
+    }
+}
+
+/**
+ * Build a single change tree for an edit, with the same root as the edit tree.
+ * Existing data under each delete, remove and replace path is set to "" (which
+ * deletes it) and the new data is merged over the top, so conditions can be
+ * checked against the end result and it can be applied in one go. Leaves a
+ * replace sets to the value they already have are left out, so only what
+ * actually differs is written. Nodes are moved out of tree.
+ */
+static GNode *
+edit_change_tree (sch_xml_to_gnode_parms parms, GNode *tree, bool need_set)
+{
+    GList *lists[] = { sch_parm_deletes (parms), sch_parm_removes (parms), sch_parm_replaces (parms) };
+    GNode *existing = NULL;
+    GNode *change = NULL;
+    GNode *query;
+    GList *iter;
+    GList *unchanged = NULL;
+    GHashTable *old_values;
+    GString *star = g_string_sized_new (256);
+    char *root = NULL;
+
+    /* Find everything that needs to go in one query */
+    query = APTERYX_NODE (NULL, g_strdup ("/"));
+    for (int i = 0; i < G_N_ELEMENTS (lists); i++)
+    {
+        for (iter = lists[i]; iter; iter = g_list_next (iter))
+        {
+            char *path = (char *) iter->data;
+            sch_node *schema = sch_lookup (g_schema, path);
+
+            if (schema && sch_is_leaf (schema))
+            {
+                apteryx_path_to_node (query, path, NULL);
+            }
+            else
+            {
+                g_string_assign (star, path);
+                g_string_append (star, "/*");
+                apteryx_path_to_node (query, star->str, NULL);
+            }
+            if (!root)
+                root = g_strndup (path, strcspn (path + 1, "/") + 1);
+        }
+    }
+    g_string_free (star, TRUE);
+    if (query->children)
+        existing = apteryx_query (query);
+    apteryx_free_tree (query);
+
+    /* Everything in an edit is below a single root */
+    if (tree)
+    {
+        g_free (root);
+        root = g_strdup (APTERYX_NAME (tree));
+    }
+    if (!root)
+        return NULL;
+
+    old_values = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+    if (existing)
+    {
+        gchar **parts = g_strsplit (root, "/", -1);
+        GNode *node = existing;
+
+        for (int i = 0; node && parts[i]; i++)
+        {
+            if (parts[i][0] != '\0')
+                node = apteryx_find_child (node, parts[i]);
+        }
+        g_strfreev (parts);
+        if (node && node != existing)
+        {
+            g_node_unlink (node);
+            g_free (node->data);
+            node->data = g_strdup (root);
+            change = node;
+            g_node_traverse (change, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1, clear_leaf_value, old_values);
+        }
+        apteryx_free_tree (existing);
+    }
+    if (!change)
+        change = APTERYX_NODE (NULL, g_strdup (root));
+    g_free (root);
+
+    /* The new data goes over the top */
+    if (tree && need_set)
+        merge_change_tree (change, tree, old_values, &unchanged);
+    for (iter = unchanged; iter; iter = g_list_next (iter))
+    {
+        g_hash_table_remove (old_values, ((GNode *) iter->data)->children);
+        drop_change_leaf (change, (GNode *) iter->data);
+    }
+    g_list_free (unchanged);
+    g_hash_table_destroy (old_values);
+    return change;
+}
+
+/* Drop the conditions staged for path or anything below it. Must be called
+ * with the candidate data lock held */
+static void
+candidate_drop_conditions (const char *path)
+{
+    size_t len = strlen (path);
+    GHashTableIter hiter;
+    gpointer key;
+
+    g_hash_table_iter_init (&hiter, candidate_conditions);
+    while (g_hash_table_iter_next (&hiter, &key, NULL))
+    {
+        const char *cpath = (const char *) key;
+
+        if (strncmp (cpath, path, len) == 0 && (cpath[len] == '/' || cpath[len] == '\n'))
+            g_hash_table_iter_remove (&hiter);
+    }
+}
+
+/* Stage an edit in the candidate. Anything already staged below a delete,
+ * remove or replace path is dropped before the change is merged in, along
+ * with the conditions it brought, and the edit's conditions are kept to be
+ * checked on commit. Takes ownership of change */
+static void
+candidate_apply (GNode *change, sch_xml_to_gnode_parms parms)
+{
+    GList *lists[] = { sch_parm_deletes (parms), sch_parm_removes (parms), sch_parm_replaces (parms) };
+    GNode *root = NULL;
+    GList *iter;
+
+    g_mutex_lock (&candidate_data_lock);
+    for (iter = candidate_roots; iter && change; iter = g_list_next (iter))
+    {
+        if (g_strcmp0 (APTERYX_NAME ((GNode *) iter->data), APTERYX_NAME (change)) == 0)
+        {
+            root = (GNode *) iter->data;
+            break;
         }
-        free (attr);
     }
 
-    return 0;
-}
-
-static bool
-handle_get (struct netconf_session *session, xmlNode * rpc, gboolean config_only)
-{
-    xmlNode *action = xmlFirstElementChild (rpc);
-    xmlNode *node;
-    GList *xml_list = NULL;
-    GList *list;
-    int schflags = 0;
-    bool filter_seen = false;
-    bool ret = false;
+    for (int i = 0; i < G_N_ELEMENTS (lists); i++)
+    {
+        for (iter = lists[i]; iter; iter = g_list_next (iter))
+        {
+            GNode *node = root ? tree_path_node (root, (char *) iter->data, false) : NULL;
+
+            candidate_drop_conditions ((char *) iter->data);
+            if (node && node == root)
+            {
+                while (root->children)
+                    apteryx_free_tree (root->children);
+            }
+            else if (node)
+            {
+                drop_change_leaf (root, node);
+            }
+        }
+    }
+
+    if (root)
+    {
+        overlay_merge (root, change);
+        apteryx_free_tree (change);
+    }
+    else if (change && change->children)
+    {
+        candidate_roots = g_list_append (candidate_roots, change);
+    }
+    else
+    {
+        apteryx_free_tree (change);
+    }
+
+    for (iter = sch_parm_conditions (parms); iter; iter = g_list_next (iter))
+    {
+        sch_condition *cond = (sch_condition *) iter->data;
+        g_hash_table_add (candidate_conditions, g_strdup_printf ("%s\n%s", cond->path, cond->condition));
+    }
+    g_mutex_unlock (&candidate_data_lock);
+}
+
+static gboolean
+collect_leaf (GNode *node, gpointer data)
+{
+    if (node->parent)
+        *(GList **) data = g_list_prepend (*(GList **) data, node);
+    return FALSE;
+}
+
+/* Work out what committing the candidate changes in running, as a tree rooted
+ * at "/" holding only the leaves that differ. Must be called with the candidate
+ * data lock held */
+static GNode *
+candidate_net_change (void)
+{
+    GNode *change = APTERYX_NODE (NULL, g_strdup ("/"));
+    GNode *query = APTERYX_NODE (NULL, g_strdup ("/"));
+    GNode *running = NULL;
+    GList *copies = NULL;
+    GList *leaves = NULL;
+    GList *paths = NULL;
+    GList *iter;
+    GList *piter;
+
+    /* Look up the current value of every staged leaf in one query */
+    for (iter = candidate_roots; iter; iter = g_list_next (iter))
+    {
+        GNode *copy = g_node_copy_deep ((GNode *) iter->data, copy_node_data, NULL);
+
+        copies = g_list_append (copies, copy);
+        g_node_traverse (copy, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1, collect_leaf, &leaves);
+    }
+    for (iter = leaves; iter; iter = g_list_next (iter))
+    {
+        char *path = apteryx_node_path (((GNode *) iter->data)->parent);
+
+        apteryx_path_to_node (query, path, NULL);
+        paths = g_list_prepend (paths, path);
+    }
+    paths = g_list_reverse (paths);
+    if (query->children)
+        running = apteryx_query (query);
+    apteryx_free_tree (query);
+
+    /* Drop anything that already matches, "" matching no value at all */
+    for (iter = leaves, piter = paths; iter; iter = g_list_next (iter), piter = g_list_next (piter))
+    {
+        GNode *leaf = ((GNode *) iter->data)->parent;
+        GNode *node = running ? tree_path_node (running, (char *) piter->data, false) : NULL;
+        const char *old = node && APTERYX_HAS_VALUE (node) ? APTERYX_VALUE (node) : "";
+
+        if (g_strcmp0 (old, APTERYX_VALUE (leaf)) == 0)
+            drop_change_leaf (g_node_get_root (leaf), leaf);
+    }
+    g_list_free_full (paths, g_free);
+    g_list_free (leaves);
+    apteryx_free_tree (running);
+
+    for (iter = copies; iter; iter = g_list_next (iter))
+    {
+        GNode *copy = (GNode *) iter->data;
+
+        if (copy->children)
+        {
+            char *name = g_strdup (APTERYX_NAME (copy) + 1);
+            g_free (copy->data);
+            copy->data = name;
+            g_node_append (change, copy);
+        }
+        else
+        {
+            apteryx_free_tree (copy);
+        }
+    }
+    g_list_free (copies);
+
+    if (!change->children)
+    {
+        apteryx_free_tree (change);
+        change = NULL;
+    }
+    return change;
+}
+
+/* Check the conditions from every staged edit, returning the path and condition
+ * of the first to fail. Must be called with the candidate data lock held */
+static gchar **
+candidate_failed_condition (void)
+{
+    GHashTableIter hiter;
+    gpointer key;
+
+    g_hash_table_iter_init (&hiter, candidate_conditions);
+    while (g_hash_table_iter_next (&hiter, &key, NULL))
+    {
+        gchar **parts = g_strsplit ((char *) key, "\n", 2);
+        bool ok = true;
+
+        for (GList *iter = candidate_roots; iter; iter = g_list_next (iter))
+        {
+            const char *name = APTERYX_NAME ((GNode *) iter->data);
+            size_t len = strlen (name);
+
+            if (strncmp (parts[0], name, len) == 0 && (parts[0][len] == '/' || parts[0][len] == '\0'))
+            {
+                ok = sch_process_condition (g_schema, (GNode *) iter->data, parts[0], parts[1]);
+                break;
+            }
+        }
+        if (!ok)
+            return parts;
+        g_strfreev (parts);
+    }
+    return NULL;
+}
+
+/* Throw away any uncommitted candidate changes. Must be called with the
+ * candidate data lock held */
+static void
+candidate_clear (void)
+{
+    g_list_free_full (candidate_roots, (GDestroyNotify) apteryx_free_tree);
+    candidate_roots = NULL;
+    if (candidate_conditions)
+        g_hash_table_remove_all (candidate_conditions);
+}
+
+/* Throw away any uncommitted candidate changes */
+static void
+candidate_discard (void)
+{
+    g_mutex_lock (&candidate_data_lock);
+    candidate_clear ();
+    g_mutex_unlock (&candidate_data_lock);
+}
+
+static bool
+candidate_modified (void)
+{
+    bool modified;
+
+    g_mutex_lock (&candidate_data_lock);
+    modified = candidate_roots != NULL;
+    g_mutex_unlock (&candidate_data_lock);
+    return modified;
+}
+
+/* Log each part of an edit that has been accepted */
+static void
+edit_log (struct netconf_session *session, sch_xml_to_gnode_parms parms)
+{
+    GList *iter;
+    char *value;
+
+    if (!(logging & LOG_EDIT_CONFIG))
+        return;
+
+    for (iter = sch_parm_deletes (parms); iter; iter = g_list_next (iter))
+    {
+        NOTICE ("EDIT-CONFIG: %s@%s id:%d delete:%s\n",
+                session->username, session->rem_addr, session->id, (char *) iter->data);
+    }
+    for (iter = sch_parm_removes (parms); iter; iter = g_list_next (iter))
+    {
+        NOTICE ("EDIT-CONFIG: %s@%s id:%d remove:%s\n",
+                session->username, session->rem_addr, session->id, (char *) iter->data);
+    }
+    for (iter = sch_parm_creates (parms); iter; iter = g_list_next (iter))
+    {
+        value = split_path_value ((char *) iter->data);
+        NOTICE ("EDIT-CONFIG: %s@%s id:%d create:%s=%s\n",
+                session->username, session->rem_addr, session->id,
+                (char *) iter->data, value);
+    }
+    for (iter = sch_parm_merges (parms); iter; iter = g_list_next (iter))
+    {
+        value = split_path_value ((char *) iter->data);
+        NOTICE ("EDIT-CONFIG: %s@%s id:%d merge:%s=%s\n",
+                session->username, session->rem_addr, session->id,
+                (char *) iter->data, value);
+    }
+    for (iter = sch_parm_replaces (parms); iter; iter = g_list_next (iter))
+    {
+        value = split_path_value ((char *) iter->data);
+        NOTICE ("EDIT-CONFIG: %s@%s id:%d replace:%s=%s\n",
+                session->username, session->rem_addr, session->id,
+                (char *) iter->data, value);
+    }
+}
+
+/* True if checking an edit reads running, so it must see any held back edits */
+static bool
+edit_reads_state (sch_xml_to_gnode_parms parms)
+{
+    return sch_parm_deletes (parms) || sch_parm_removes (parms) || sch_parm_creates (parms) ||
+           sch_parm_replaces (parms) || sch_parm_conditions (parms);
+}
+
+/* True if the client has already sent more than this session has read */
+static bool
+message_waiting (struct netconf_session *session)
+{
+    char byte;
+
+    return recv (session->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 1;
+}
+
+/* Hold an accepted edit back, merged with any others from this session */
+static void
+coalesce_add (struct netconf_session *session, xmlNode * rpc, GNode *change)
+{
+    if (!session->pending_edit)
+        session->pending_edit = APTERYX_NODE (NULL, g_strdup ("/"));
+    if (change)
+        overlay_merge (tree_path_node (session->pending_edit, APTERYX_NAME (change), true), change);
+    session->pending_rpcs = g_list_prepend (session->pending_rpcs, xmlCopyNode (rpc, 2));
+}
+
+/* Apply the edits this session has held back in one transaction, then reply
+ * to each of them in order */
+static void
+coalesce_flush (struct netconf_session *session, bool closing)
+{
+    GNode *pending = session->pending_edit;
+    GList *rpcs = g_list_reverse (session->pending_rpcs);
+    NC_ERR_TAG err_tag = NC_ERR_TAG_UNKNOWN;
+    GList *iter;
+
+    if (!rpcs)
+        return;
+    session->pending_edit = NULL;
+    session->pending_rpcs = NULL;
+
+    /* The edits were checked before another session could have locked running */
+    if (running_ds_lock.locked == TRUE && session->id != running_ds_lock.nc_sess.id)
+        err_tag = NC_ERR_TAG_IN_USE;
+    else if (pending && pending->children && !running_set_tree (pending))
+        err_tag = NC_ERR_TAG_OPR_FAILED;
+    DEBUG ("NETCONF: SET %d coalesced edits\n", g_list_length (rpcs));
+    apteryx_free_tree (pending);
+
+    for (iter = rpcs; iter; iter = g_list_next (iter))
+    {
+        xmlNode *rpc = (xmlNode *) iter->data;
+
+        if (err_tag == NC_ERR_TAG_UNKNOWN)
+        {
+            session->counters.in_rpcs++;
+            netconf_global_stats.session_totals.in_rpcs++;
+            send_rpc_ok (session, rpc, closing);
+        }
+        else
+        {
+            send_rpc_error_full (session, rpc, err_tag, NC_ERR_TYPE_APP, NULL, NULL, NULL,
+                                 err_tag != NC_ERR_TAG_IN_USE);
+        }
+        xmlFreeNode (rpc);
+    }
+    g_list_free (rpcs);
+}
+
+/* Decode an edit and check it against the existing data and its conditions,
+ * without writing anything. On failure the rpc-error has been sent. With
+ * keep_going the parts that fail are left out of the change instead, and
+ * errors found here are added to rerrors */
+static bool
+edit_prepare (struct netconf_session *session, xmlNode * rpc, xmlNode * config,
+              nc_operation def_op, nc_datastore ds, bool keep_going,
+              sch_xml_to_gnode_parms *rparms, GNode **rtree, GNode **rchange, GList **rerrors)
+{
+    sch_xml_to_gnode_parms parms;
+    GNode *tree;
+    GNode *change;
+    int schflags = 0;
+    GList *iter;
+
+    if (apteryx_netconf_verbose)
+        schflags |= SCH_F_DEBUG;
+
+    /* Convert to gnode */
+    parms =
+        sch_xml_to_gnode (g_schema, NULL, xmlFirstElementChild (config), schflags, def_op,
+                          true, keep_going, NULL);
+
+    tree = sch_parm_tree (parms);
+
+    nc_error_parms error_parms = sch_parm_error (parms);
+
+    if (error_parms.tag != 0)
+    {
+        VERBOSE ("error parsing XML\n");
+        coalesce_flush (session, false);
+        if (error_parms.type == NC_ERR_TYPE_RPC)
+        {
+            session->counters.in_bad_rpcs++;
+            netconf_global_stats.session_totals.in_bad_rpcs++;
+        }
+        _send_rpc_error (session, rpc, error_parms);
+        sch_parm_free (parms);
+        apteryx_free_tree (tree);
+        return false;
+    }
+
+    /* Anything that reads running needs the edits held back so far applied */
+    if (ds != NC_DS_RUNNING || edit_reads_state (parms))
+        coalesce_flush (session, false);
+
+    /* Check delete and create paths */
+    NC_ERR_TAG err_tag = NC_ERR_TAG_UNKNOWN;
+    const char *bad_path = _check_exist (sch_parm_deletes (parms), sch_parm_creates (parms), ds, &err_tag,
+                                         keep_going ? rerrors : NULL);
+    if (bad_path && keep_going)
+    {
+        /* Missing deletes change nothing, creates of existing data are left out */
+        for (iter = *rerrors; iter; iter = g_list_next (iter))
+        {
+            nc_error_parms *error = (nc_error_parms *) iter->data;
+            GNode *node;
+
+            if (error->tag != NC_ERR_TAG_DATA_EXISTS || !tree)
+                continue;
+            node = tree_path_node (tree, g_hash_table_lookup (error->info, "error-path"), false);
+            if (node && node != tree)
+                drop_change_leaf (tree, node);
+        }
+    }
+    else if (bad_path)
+    {
+        if (logging & LOG_EDIT_CONFIG)
+        {
+            gchar *err_msg = NULL;
+            err_msg = g_strdup_printf ("EDIT_CONFIG: error while %s path %s - %s\n",
+                                       err_tag == NC_ERR_TAG_DATA_MISSING ? "deleting" : "creating",
+                                       bad_path, rpc_error_tag_to_string (err_tag));
+            ERROR ("%s\n", err_msg);
+            g_free (err_msg);
+        }
+        send_rpc_error_full (session, rpc, err_tag, NC_ERR_TYPE_APP, NULL, NULL, NULL, true);
+        sch_parm_free (parms);
+        apteryx_free_tree (tree);
+        return false;
+    }
+
+    //TODO - permissions
+    //TODO - patterns
+
+    /* Combine deletes, removes, replaces and the new data into one change */
+    change = edit_change_tree (parms, tree, sch_parm_need_tree_set (parms));
+
+    /* Check the conditions against the end result. Candidate conditions wait for commit */
+    for (iter = ds == NC_DS_RUNNING ? sch_parm_conditions (parms) : NULL; iter; iter = g_list_next (iter))
+    {
+        sch_condition *cond = (sch_condition *) iter->data;
+
+        if (!sch_process_condition (g_schema, change, cond->path, cond->condition))
+        {
+            if (logging & LOG_EDIT_CONFIG)
+            {
+                ERROR ("EDIT-CONFIG: Path <%s> failed condition <%s>\n", cond->path, cond->condition);
+            }
+            if (keep_going)
+            {
+                GNode *node = change ? tree_path_node (change, cond->path, false) : NULL;
+
+                /* Leave out the data that failed its condition */
+                if (node && node != change)
+                    drop_change_leaf (change, node);
+                *rerrors = g_list_append (*rerrors, _new_error_parms (NC_ERR_TAG_INVALID_VAL,
+                                                                      NC_ERR_TYPE_PROTOCOL, cond->path));
+                continue;
+            }
+            send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL, NULL, NULL, NULL, true);
+            sch_parm_free (parms);
+            apteryx_free_tree (change);
+            apteryx_free_tree (tree);
+            return false;
+        }
+    }
+
+    *rparms = parms;
+    *rtree = tree;
+    *rchange = change;
+    return true;
+}
+
+/* Reply to an edit that was carried out, with ok or the errors from any parts
+ * that were left out. Frees the parms and errors */
+static bool
+edit_reply (struct netconf_session *session, xmlNode * rpc, sch_xml_to_gnode_parms parms,
+            GList *errors)
+{
+    GList *all = g_list_concat (g_list_copy (sch_parm_errors (parms)), g_list_copy (errors));
+    bool ret;
+
+    if (all)
+    {
+        ret = _send_rpc_errors (session, rpc, all);
+    }
+    else
+    {
+        session->counters.in_rpcs++;
+        netconf_global_stats.session_totals.in_rpcs++;
+        ret = send_rpc_ok (session, rpc, false);
+    }
+    g_list_free (all);
+    g_list_free_full (errors, _destroy_error_parms);
+    sch_parm_free (parms);
+    return ret;
+}
+
+/* Send an edit's rpc-error after the replies to any edits held back before it */
+static bool
+edit_error (struct netconf_session *session, xmlNode * rpc, NC_ERR_TAG err_tag,
+            NC_ERR_TYPE err_type, gchar *error_msg, char *bad_elem, bool no_info)
+{
+    coalesce_flush (session, false);
+    return send_rpc_error_full (session, rpc, err_tag, err_type, error_msg, bad_elem, NULL,
+                                no_info);
+}
+
+static bool
+handle_edit (struct netconf_session *session, xmlNode * rpc)
+{
+    xmlNode *action = xmlFirstElementChild (rpc);
+    xmlNode *node;
+    GNode *tree = NULL;
+    GNode *change = NULL;
+    sch_xml_to_gnode_parms parms;
+    struct ds_lock *lock;
+    nc_datastore ds;
+    bool ret = false;
+    nc_operation def_op = NC_OP_MERGE;
+    nc_test_option test_opt = NC_TEST_THEN_SET;
+    nc_error_option error_opt = NC_ERROR_STOP;
+    GList *errors = NULL;
+
+    /* Check the target */
+    node = xmlFindNodeByName (action, BAD_CAST "target");
+    if (!node)
+    {
+        VERBOSE ("Missing \"target\" element\n");
+        ret = edit_error (session, rpc, NC_ERR_TAG_MISSING_ELEM, NC_ERR_TYPE_PROTOCOL,
+                          "Missing target element", "target", false);
+        return ret;
+    }
+    xmlNodePtr child = xmlFirstElementChild (node);
+    lock = target_ds_lock (child);
+    if (!lock)
+    {
+        gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported",
+                                            child ? (char *) child->name : "null");
+        VERBOSE ("%s\n", error_msg);
+        ret = edit_error (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
+                          error_msg, NULL, true);
+        g_free (error_msg);
+        return ret;
+    }
+    if (lock == &startup_ds_lock)
+    {
+        /* Startup is only written by copy-config */
+        VERBOSE ("Datastore \"startup\" not writable by edit-config\n");
+        return edit_error (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
+                           "Datastore \"startup\" not writable by edit-config", NULL, true);
+    }
+
+    /* Check and record default-operation */
+    if (!_handle_default_operation (action, &def_op))
+    {
+        return edit_error (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                           "Invalid value for default-operation parameter", NULL, true);
+    }
 
-    if (apteryx_netconf_verbose)
-        schflags |= SCH_F_DEBUG;
+    /* Check and record test-option */
+    if (!_handle_test_option (action, &test_opt))
+    {
+        return edit_error (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                           "Invalid value for test-option parameter", NULL, true);
+    }
 
-    if (config_only)
+    /* Check and record error-option. Edits are applied in one transaction, so
+     * stopping on an error always leaves running as it was, as rollback requires */
+    if (!_handle_error_option (action, &error_opt))
     {
-        schflags |= SCH_F_CONFIG;
+        return edit_error (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                           "Invalid value for error-option parameter", NULL, true);
     }
 
-    /* Validate lock if configured on the running datastore */
-    if (running_ds_lock.locked == TRUE && (session->id != running_ds_lock.nc_sess.id))
+    /* Validate lock if configured on the target datastore */
+    ds = lock_datastore (lock);
+    if (lock->locked == TRUE && (session->id != lock->nc_sess.id))
     {
-        /* A lock is already held by another NETCONF session, return lock-denied */
+        /* A lock is already held by another NETCONF session, return in-use */
         VERBOSE ("Lock failed, lock is already held\n");
-        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
-                                   "Lock is already held", NULL, NULL, false);
+        ret = edit_error (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
+                          "Lock is already held", NULL, false);
         return ret;
     }
 
-    /* Parse options - first look for with-defaults option as this changes the way query lookup works */
-    for (node = xmlFirstElementChild (action); node; node = xmlNextElementSibling (node))
+    /* Find the config */
+    node = xmlFindNodeByName (action, BAD_CAST "config");
+    if (!node)
     {
-        if (g_strcmp0 ((char *) node->name, "with-defaults") == 0)
-        {
-            char *defaults_type = (char *) xmlNodeGetContent (node);
-            if (g_strcmp0 (defaults_type, "report-all") == 0)
-            {
-                schflags |= SCH_F_ADD_DEFAULTS;
-            }
-            else if (g_strcmp0 (defaults_type, "trim") == 0)
-            {
-                schflags |= SCH_F_TRIM_DEFAULTS;
-            }
-            else if (g_strcmp0 (defaults_type, "explicit") != 0)
-            {
-                gchar *error_msg = g_strdup_printf ("WITH-DEFAULTS: No support for with-defaults query type \"%s\"",
-                                                    defaults_type);
-                ERROR ("%s\n", error_msg);
-                ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
-                                           error_msg, NULL, NULL, true);
-                g_free (error_msg);
-                free (defaults_type);
-                return ret;
-            }
-            free (defaults_type);
-            break;
-        }
+        VERBOSE ("Missing \"config\" element\n");
+        ret = edit_error (session, rpc, NC_ERR_TAG_MISSING_ELEM, NC_ERR_TYPE_PROTOCOL,
+                          "Missing config element", "config", false);
+        return ret;
     }
 
-    /* Parse the remaining options */
-    for (node = xmlFirstElementChild (action); node; node = xmlNextElementSibling (node))
+    /* Decode and check the edit, which is all a test-only edit does */
+    if (!edit_prepare (session, rpc, node, def_op, ds, error_opt == NC_ERROR_CONTINUE,
+                       &parms, &tree, &change, &errors))
+        return false;
+    if (test_opt == NC_TEST_ONLY)
     {
-        if (g_strcmp0 ((char *) node->name, "with-defaults") == 0)
-            continue;
-
-        if (get_process_action (session, rpc, node, schflags, &xml_list, &filter_seen, &ret) < 0)
-        {
-            /* Cleanup any requests added to the xml_list before hitting an error */
-            for (list = g_list_first (xml_list); list; list = g_list_next (list))
-            {
-                xmlFree (list->data);
-            }
-            g_list_free (xml_list);
+        coalesce_flush (session, false);
+        apteryx_free_tree (change);
+        apteryx_free_tree (tree);
+        return edit_reply (session, rpc, parms, errors);
+    }
 
-            return ret;
-        }
+    /* Candidate changes are only staged, conditions are checked on commit */
+    if (ds == NC_DS_CANDIDATE)
+    {
+        DEBUG ("NETCONF: CANDIDATE %s\n", change ? APTERYX_NAME (change) : "NULL");
+        candidate_apply (change, parms);
+        change = NULL;
     }
 
-    /* Catch for get without filter */
-    if (!filter_seen && !xml_list)
+    /* Plain merges are held back while the client has more requests waiting,
+     * so a burst of them is applied in one transaction */
+    if (apteryx_netconf_coalesce && ds == NC_DS_RUNNING && !errors && !sch_parm_errors (parms) &&
+        !edit_reads_state (parms))
     {
-        if (!get_query_to_xml (session, rpc, NULL, NULL, 0, NULL, NULL, NULL,
-                               XPATH_NONE, schflags, false, false, &xml_list, NULL, 0))
-        {
-            session->counters.in_bad_rpcs++;
-            netconf_global_stats.session_totals.in_bad_rpcs++;
-            return false;
-        }
+        coalesce_add (session, rpc, change);
+        edit_log (session, parms);
+        apteryx_free_tree (change);
+        apteryx_free_tree (tree);
+        sch_parm_free (parms);
+        if (g_list_length (session->pending_rpcs) >= COALESCE_MAX_EDITS || !message_waiting (session))
+            coalesce_flush (session, false);
+        return true;
     }
 
-    /* Send response */
-    send_rpc_data (session, rpc, xml_list);
-    session->counters.in_rpcs++;
-    netconf_global_stats.session_totals.in_rpcs++;
+    /* Edit database - everything in one transaction, after any held back edits */
+    coalesce_flush (session, false);
+    DEBUG ("NETCONF: SET %s need_set %d\n", change ? APTERYX_NAME (change) : "NULL", sch_parm_need_tree_set (parms));
+    if (change && change->children && !running_set_tree (change))
+    {
+        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP, NULL, NULL, NULL, true);
+        apteryx_free_tree (change);
+        apteryx_free_tree (tree);
+        sch_parm_free (parms);
+        g_list_free_full (errors, _destroy_error_parms);
+        return ret;
+    }
+    apteryx_free_tree (change);
 
-    return true;
+    edit_log (session, parms);
+    apteryx_free_tree (tree);
+    return edit_reply (session, rpc, parms, errors);
 }
 
-static xmlNode *
-xmlFindNodeByName (xmlNode * root, const xmlChar * name)
+static bool
+handle_validate (struct netconf_session *session, xmlNode * rpc)
 {
+    xmlNode *action = xmlFirstElementChild (rpc);
+    xmlNode *node;
     xmlNode *child;
 
-    for (child = xmlFirstElementChild (root); child; child = xmlNextElementSibling (child))
+    /* Check the source */
+    node = xmlFindNodeByName (action, BAD_CAST "source");
+    child = node ? xmlFirstElementChild (node) : NULL;
+    if (!child)
     {
-        if (!xmlStrcmp (child->name, name))
+        VERBOSE ("Missing \"source\" element\n");
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ELEM, NC_ERR_TYPE_PROTOCOL,
+                                    "Missing source element", "source", NULL, false);
+    }
+
+    if (g_strcmp0 ((char *) child->name, "config") == 0)
+    {
+        sch_xml_to_gnode_parms parms;
+        GNode *tree = NULL;
+        GNode *change = NULL;
+
+        /* Run the whole edit pipeline on the inline config, writing nothing */
+        if (!edit_prepare (session, rpc, child, NC_OP_MERGE, NC_DS_RUNNING, false, &parms, &tree, &change, NULL))
+            return false;
+        sch_parm_free (parms);
+        apteryx_free_tree (change);
+        apteryx_free_tree (tree);
+    }
+    else if (g_strcmp0 ((char *) child->name, "candidate") == 0)
+    {
+        gchar **failed;
+
+        /* The staged edits have only had their conditions checked on commit */
+        g_mutex_lock (&candidate_data_lock);
+        failed = candidate_failed_condition ();
+        g_mutex_unlock (&candidate_data_lock);
+        if (failed)
         {
-            return child;
+            if (logging & LOG_EDIT_CONFIG)
+            {
+                ERROR ("VALIDATE: Path <%s> failed condition <%s>\n", failed[0], failed[1]);
+            }
+            g_strfreev (failed);
+            return send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                                        NULL, NULL, NULL, true);
         }
     }
-    return NULL;
+    else if (startup_path && g_strcmp0 ((char *) child->name, "startup") == 0)
+    {
+        GList *roots = NULL;
+
+        /* Startup is valid if every subtree in the file decodes */
+        if (!startup_load (&roots))
+            return send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP,
+                                        "Startup datastore is not valid", NULL, NULL, true);
+        g_list_free_full (roots, (GDestroyNotify) apteryx_free_tree);
+    }
+    else if (g_strcmp0 ((char *) child->name, "running") != 0)
+    {
+        /* Running was checked as each edit was applied */
+        gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported", (char *) child->name);
+        bool ret;
+
+        VERBOSE ("%s\n", error_msg);
+        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
+                                   error_msg, NULL, NULL, true);
+        g_free (error_msg);
+        return ret;
+    }
+
+    /* Success */
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    return send_rpc_ok (session, rpc, false);
 }
 
-/**
- * Check for existence of data at a particular xpath or below. This is
- * required for NC_OP_CREATE and NC_OP_DELETE. Fill in the error_tag if we don't
- * get expected result, otherwise leave it alone (so we can accumulate errors).
- */
-static void
-_check_exist (const char *check_xpath, NC_ERR_TAG *err_tag, bool expected)
+/* True if path, or one of its ancestors, is in the set of subtree paths */
+static bool
+path_in_subtrees (GHashTable *subtrees, const char *path)
 {
-    GNode *check_result;
+    char *tmp = g_strdup (path);
+    char *slash;
+    bool found = false;
 
-    check_result = apteryx_get_tree (check_xpath);
-    if (check_result && !expected)
-    {
-        *err_tag = NC_ERR_TAG_DATA_EXISTS;
-    }
-    else if (!check_result && expected)
+    while (!found && (slash = strrchr (tmp, '/')) && slash != tmp)
     {
-        *err_tag = NC_ERR_TAG_DATA_MISSING;
+        *slash = '\0';
+        found = g_hash_table_contains (subtrees, tmp);
     }
-    apteryx_free_tree (check_result);
+    g_free (tmp);
+    return found;
 }
 
-/**
- * Process the default-operation option in an edit element, returning whether the
- * edit_config processing can continue. The other return via passed in pointers is
- * the default operation (points to a static string)
- */
 static bool
-_handle_default_operation (xmlNode *action, char **def_op_pt)
+handle_get_changes (struct netconf_session *session, xmlNode * rpc)
 {
-    xmlNode *def_op_node;
-    xmlChar *def_op_content;
-    bool def_op_inv_value = false;
+    xmlNode *action = xmlFirstElementChild (rpc);
+    xmlNode *node;
+    xmlNode *reply;
+    xmlDoc *doc;
+    xmlNs *ns;
+    GHashTable *changed;
+    GHashTable *subtrees;
+    GHashTableIter hiter;
+    gpointer key;
+    GNode *query = NULL;
+    GNode *tree = NULL;
+    char *since = NULL;
+    gchar *token;
+    guint64 seq = 0;
+    bool resync;
+    bool ret;
 
-    /* Find the default-operation parameter, if not there, just return with def_op set to "merge" */
-    def_op_node = xmlFindNodeByName (action, BAD_CAST "default-operation");
-    if (!def_op_node)
+    node = xmlFindNodeByName (action, BAD_CAST "since");
+    if (node)
     {
-        *def_op_pt = "merge";
-        return true;
+        since = (char *) xmlNodeGetContent (node);
+        if (since)
+            g_strstrip (since);
     }
 
-    /* Check the parameter contents. */
-    def_op_content = xmlNodeGetContent (def_op_node);
-    if (def_op_content)
+    /* Collect everything changed since the token from the journal */
+    changed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    g_mutex_lock (&generation_lock);
+    resync = !generation_token_parse (since, &seq) || seq > running_generation ||
+             seq < journal_evicted_seq;
+    if (!resync)
     {
-        if (g_strcmp0 ((char *) def_op_content, "merge") == 0)
+        guint64 first = journal_count > NETCONF_JOURNAL_SIZE ? journal_count - NETCONF_JOURNAL_SIZE : 0;
+        for (guint64 i = first; i < journal_count; i++)
         {
-            *def_op_pt = "merge";
+            journal_entry *entry = &change_journal[i % NETCONF_JOURNAL_SIZE];
+            if (entry->seq > seq)
+                g_hash_table_add (changed, g_strdup (entry->path));
         }
-        else if (g_strcmp0 ((char *) def_op_content, "replace") == 0)
+    }
+    token = generation_token (running_generation);
+    g_mutex_unlock (&generation_lock);
+    free (since);
+
+    doc = create_rpc (BAD_CAST "rpc-reply", xmlGetProp (rpc, BAD_CAST "message-id"));
+    reply = xmlDocGetRootElement (doc);
+    ns = xmlNewNs (reply, BAD_CAST NETCONF_CHANGES_NS, BAD_CAST "ch");
+    if (resync)
+    {
+        VERBOSE ("GET-CHANGES: resync required\n");
+        xmlNewChild (reply, ns, BAD_CAST "resync-required", NULL);
+    }
+    else
+    {
+        /* Query the current value of each changed leaf or subtree in one go */
+        subtrees = g_hash_table_new (g_str_hash, g_str_equal);
+        g_hash_table_iter_init (&hiter, changed);
+        while (g_hash_table_iter_next (&hiter, &key, NULL))
         {
-            *def_op_pt = "replace";
+            sch_node *schema = sch_lookup (g_schema, (char *) key);
+            if (schema && !sch_is_leaf (schema))
+                g_hash_table_add (subtrees, key);
         }
-        else if (g_strcmp0 ((char *) def_op_content, "none") == 0)
+        query = APTERYX_NODE (NULL, g_strdup ("/"));
+        g_hash_table_iter_init (&hiter, changed);
+        while (g_hash_table_iter_next (&hiter, &key, NULL))
+        {
+            char *path = (char *) key;
+
+            if (path_in_subtrees (subtrees, path) || !sch_lookup (g_schema, path))
+                continue;
+            if (g_hash_table_contains (subtrees, path))
+            {
+                char *star = g_strdup_printf ("%s/*", path);
+                apteryx_path_to_node (query, star, NULL);
+                g_free (star);
+            }
+            else
+                apteryx_path_to_node (query, path, NULL);
+        }
+        tree = query->children ? apteryx_query (query) : NULL;
+        if (tree)
         {
-            *def_op_pt = "none";
+            xmlNode *data = xmlNewChild (reply, NULL, BAD_CAST "data", NULL);
+            xmlAddChildList (data, sch_gnode_to_xml (g_schema, NULL, tree, SCH_F_CONFIG));
         }
         else
+            xmlNewChild (reply, NULL, BAD_CAST "data", NULL);
+
+        /* Anything changed that is no longer there has been deleted */
+        g_hash_table_iter_init (&hiter, changed);
+        while (g_hash_table_iter_next (&hiter, &key, NULL))
         {
-            def_op_inv_value = true;
+            char *path = (char *) key;
+            if (!path_in_subtrees (subtrees, path) && sch_lookup (g_schema, path) &&
+                (!tree || !tree_has_path (tree, path)))
+                xmlNewTextChild (reply, ns, BAD_CAST "deleted", BAD_CAST path);
         }
-        xmlFree (def_op_content);
+        g_hash_table_destroy (subtrees);
+        apteryx_free_tree (query);
+        apteryx_free_tree (tree);
     }
-    else
+    xmlNewTextChild (reply, ns, BAD_CAST "sync-token", BAD_CAST token);
+
+    ret = send_rpc_reply_doc (session, doc);
+    xmlFreeDoc (doc);
+    g_hash_table_destroy (changed);
+    g_free (token);
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    return ret;
+}
+
+static void
+set_lock (struct ds_lock *lock, struct netconf_session *session)
+{
+    lock->locked = TRUE;
+    lock->nc_sess.id = session->id;
+    lock->nc_sess.fd = session->fd;
+}
+
+static bool
+handle_lock (struct netconf_session *session, xmlNode * rpc)
+{
+    xmlNode *action = xmlFirstElementChild (rpc);
+    xmlNode *node;
+    struct ds_lock *lock;
+    bool ret = true;
+
+    /* Check the target */
+    node = xmlFindNodeByName (action, BAD_CAST "target");
+    if (!node)
     {
-        def_op_inv_value = true;
+        VERBOSE ("Missing \"target\" element\n");
+        ret =
+            send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ELEM,
+                                 NC_ERR_TYPE_PROTOCOL, "Missing target element", "target",
+                                 NULL, false);
+        return ret;
+    }
+    xmlNodePtr child = xmlFirstElementChild (node);
+    lock = target_ds_lock (child);
+    if (!lock)
+    {
+        gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported",
+                                            child ? (char *) child->name : "null");
+        VERBOSE ("%s\n", error_msg);
+        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
+                                   error_msg, NULL, NULL, true);
+        g_free (error_msg);
+        return ret;
     }
 
-    /* If contents are invalid, send RPC error */
-    if (def_op_inv_value)
+    /* The candidate cannot be locked while it has uncommitted changes */
+    if (lock == &candidate_ds_lock && lock->locked == FALSE && candidate_modified ())
     {
-        return false;
+        VERBOSE ("Candidate has uncommitted changes\n");
+        ret =  send_rpc_error_full (session, rpc, NC_ERR_TAG_LOCK_DENIED, NC_ERR_TYPE_PROTOCOL,
+                                    "Candidate has uncommitted changes", NULL, NULL, true);
+        return ret;
     }
-    return true;
-}
 
-static char *
-split_path_value (char *path)
-{
-    char *value = strrchr (path, '/');
-    if (value)
+    /* Attempt to acquire lock */
+    if (lock->locked == FALSE)
     {
-        *value = '\0';
-        value++;
+        /* Acquire lock on the target datastore */
+        set_lock (lock, session);
     }
-    if (!value || strlen (value) == 0)
+    else
     {
-        value = "";
+        /* Return lock-denied */
+        gchar *error_msg = g_strdup_printf ("Lock is already held by session id %d",
+                                            lock->nc_sess.id);
+        VERBOSE ("%s\n", error_msg);
+        ret =  send_rpc_error_full (session, rpc, NC_ERR_TAG_LOCK_DENIED, NC_ERR_TYPE_PROTOCOL,
+                                    error_msg, NULL, NULL, false);
+        g_free (error_msg);
+        return ret;
     }
-    return value;
+    if ((logging & LOG_LOCK))
+        NOTICE ("LOCK: %s@%s id:%d\n", session->username, session->rem_addr, session->id);
+
+    /* Success */
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    return send_rpc_ok (session, rpc, false);
+}
+
+static void
+reset_lock (struct ds_lock *lock)
+{
+    lock->locked = FALSE;
+    lock->nc_sess.id = 0;
+    lock->nc_sess.fd = -1;
 }
 
 static bool
-handle_edit (struct netconf_session *session, xmlNode * rpc)
+handle_unlock (struct netconf_session *session, xmlNode * rpc)
 {
     xmlNode *action = xmlFirstElementChild (rpc);
     xmlNode *node;
-    GNode *tree = NULL;
-    sch_xml_to_gnode_parms parms;
-    sch_node *qschema = NULL;
-    int schflags = 0;
-    GList *iter;
-    char *exists;
+    struct ds_lock *lock;
     bool ret = false;
-    char *def_op = NULL;
-
-    if (apteryx_netconf_verbose)
-        schflags |= SCH_F_DEBUG;
 
     /* Check the target */
     node = xmlFindNodeByName (action, BAD_CAST "target");
@@ -2011,213 +4863,429 @@ handle_edit (struct netconf_session *session, xmlNode * rpc)
         return ret;
     }
     xmlNodePtr child = xmlFirstElementChild (node);
-    if (!child ||
-        xmlStrcmp (child->name, BAD_CAST "running"))
+    lock = target_ds_lock (child);
+    if (!lock)
     {
         gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported",
                                             child ? (char *) child->name : "null");
         VERBOSE ("%s\n", error_msg);
-        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
-                                   error_msg, NULL, NULL, true);
+        ret =
+            send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED,
+                                 NC_ERR_TYPE_PROTOCOL, error_msg, NULL, NULL, false);
         g_free (error_msg);
         return ret;
     }
 
-    /* Check and record default-operation */
-    if (!_handle_default_operation (action, &def_op))
+    /* Check unlock operation validity */
+    if (!lock->locked)
     {
-        return send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
-                                    "Invalid value for default-operation parameter", NULL, NULL, true);
+        gchar *error_msg = g_strdup_printf ("Unlock failed, no lock configured on the \"%s\" datastore",
+                                            (char *) xmlFirstElementChild (node)->name);
+        VERBOSE ("%s\n", error_msg);
+        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_PROTOCOL,
+                                   error_msg, NULL, NULL, true);
+        g_free (error_msg);
+        return ret;
+    }
+    else if ((lock->locked == TRUE) && (session->id != lock->nc_sess.id))
+    {
+        /* Lock held by another session */
+        gchar *error_msg = g_strdup_printf ("Unlock failed, session %u does not own the lock", session->id);
+        VERBOSE ("%s\n", error_msg);
+        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_LOCK_DENIED, NC_ERR_TYPE_PROTOCOL,
+                                   error_msg, NULL, NULL, false);
+        g_free (error_msg);
+        return ret;
     }
 
-    //TODO Check test-option
-    //TODO Check error-option
+    /* Unlock the datastore, uncommitted candidate changes are discarded */
+    reset_lock (lock);
+    if (lock == &candidate_ds_lock)
+        candidate_discard ();
 
-    /* Validate lock if configured on the running datastore */
-    if (running_ds_lock.locked == TRUE && (session->id != running_ds_lock.nc_sess.id))
+    if ((logging & LOG_UNLOCK))
+        NOTICE ("UNLOCK: %s@%s id:%d\n", session->username, session->rem_addr, session->id);
+
+    /* Success */
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    return send_rpc_ok (session, rpc, false);
+}
+
+static bool
+handle_commit (struct netconf_session *session, xmlNode * rpc)
+{
+    GNode *change;
+    gchar **failed;
+    bool ret = false;
+
+    /* Commit writes running, so a lock on either datastore by another session blocks it */
+    if ((running_ds_lock.locked == TRUE && session->id != running_ds_lock.nc_sess.id) ||
+        (candidate_ds_lock.locked == TRUE && session->id != candidate_ds_lock.nc_sess.id))
     {
-        /* A lock is already held by another NETCONF session, return in-use */
-        VERBOSE ("Lock failed, lock is already held\n");
+        VERBOSE ("Commit failed, lock is already held\n");
         ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
                                    "Lock is already held", NULL, NULL, false);
         return ret;
     }
 
-    /* Find the config */
-    node = xmlFindNodeByName (action, BAD_CAST "config");
-    if (!node)
+    g_mutex_lock (&candidate_data_lock);
+
+    /* Check the conditions from every staged edit against the final result */
+    failed = candidate_failed_condition ();
+    if (failed)
     {
-        VERBOSE ("Missing \"config\" element\n");
-        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ELEM, NC_ERR_TYPE_PROTOCOL,
-                                   "Missing config element", "config", NULL, false);
-        return ret;
+        if (logging & LOG_EDIT_CONFIG)
+        {
+            ERROR ("COMMIT: Path <%s> failed condition <%s>\n", failed[0], failed[1]);
+        }
+        g_strfreev (failed);
+        g_mutex_unlock (&candidate_data_lock);
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                                    NULL, NULL, NULL, true);
     }
 
-    /* Convert to gnode */
-    parms =
-        sch_xml_to_gnode (g_schema, NULL, xmlFirstElementChild (node), schflags, def_op,
-                          true, &qschema);
+    /* Apply only what differs from running, in one transaction */
+    change = candidate_net_change ();
+    DEBUG ("NETCONF: COMMIT %s\n", change ? "changes" : "no changes");
+    if (change && !running_set_tree (change))
+    {
+        g_mutex_unlock (&candidate_data_lock);
+        apteryx_free_tree (change);
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP,
+                                    NULL, NULL, NULL, true);
+    }
+    /* Clear the candidate before another session can stage anything */
+    candidate_clear ();
+    g_mutex_unlock (&candidate_data_lock);
+    apteryx_free_tree (change);
 
-    tree = sch_parm_tree (parms);
+    if (logging & LOG_EDIT_CONFIG)
+        NOTICE ("COMMIT: %s@%s id:%d\n", session->username, session->rem_addr, session->id);
 
-    nc_error_parms error_parms = sch_parm_error (parms);
+    /* Success */
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    return send_rpc_ok (session, rpc, false);
+}
 
-    if (error_parms.tag != 0)
+static bool
+handle_discard_changes (struct netconf_session *session, xmlNode * rpc)
+{
+    /* Validate lock if configured on the candidate datastore */
+    if (candidate_ds_lock.locked == TRUE && session->id != candidate_ds_lock.nc_sess.id)
     {
-        VERBOSE ("error parsing XML\n");
-        if (error_parms.type == NC_ERR_TYPE_RPC)
-        {
-            session->counters.in_bad_rpcs++;
-            netconf_global_stats.session_totals.in_bad_rpcs++;
-        }
-        ret = _send_rpc_error (session, rpc, error_parms);
-        sch_parm_free (parms);
-        apteryx_free_tree (tree);
-        return ret;
+        VERBOSE ("Discard failed, lock is already held\n");
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
+                                    "Lock is already held", NULL, NULL, false);
     }
 
-    /* Check delete and create paths */
-    NC_ERR_TAG err_tag = NC_ERR_TAG_UNKNOWN;
-    for (iter = sch_parm_deletes (parms); iter; iter = g_list_next (iter))
+    candidate_discard ();
+
+    /* Success */
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    return send_rpc_ok (session, rpc, false);
+}
+
+/* Find the datastore named by a source or target parameter */
+static xmlNode *
+rpc_datastore (struct netconf_session *session, xmlNode * rpc, const char *param)
+{
+    xmlNode *node = xmlFindNodeByName (xmlFirstElementChild (rpc), BAD_CAST param);
+    xmlNode *child = node ? xmlFirstElementChild (node) : NULL;
+
+    if (!child)
     {
-        _check_exist ((char *) iter->data, &err_tag, true);
-        if (err_tag != NC_ERR_TAG_UNKNOWN)
-        {
-            if (logging & LOG_EDIT_CONFIG)
-            {
-                gchar *err_msg = NULL;
-                err_msg = g_strdup_printf ("EDIT_CONFIG: error while deleting path %s - %s\n",
-                                            (char *) iter->data,
-                                            rpc_error_tag_to_string (err_tag));
-                ERROR ("%s\n", err_msg);
-                g_free (err_msg);
-            }
-            ret = send_rpc_error_full (session, rpc, err_tag, NC_ERR_TYPE_APP, NULL, NULL, NULL, true);
-            sch_parm_free (parms);
-            apteryx_free_tree (tree);
-            return ret;
-        }
+        gchar *error_msg = g_strdup_printf ("Missing %s element", param);
+
+        VERBOSE ("Missing \"%s\" element\n", param);
+        send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ELEM, NC_ERR_TYPE_PROTOCOL,
+                             error_msg, (char *) param, NULL, false);
+        g_free (error_msg);
     }
-    for (iter = sch_parm_creates (parms); iter; iter = g_list_next (iter))
+    return child;
+}
+
+typedef struct _import_leaves
+{
+    GHashTable *leaves;
+    bool config_only;
+} import_leaves;
+
+static gboolean
+import_leaf (GNode *node, gpointer data)
+{
+    import_leaves *collect = (import_leaves *) data;
+    char *path;
+
+    if (!node->parent || !node->parent->parent)
+        return FALSE;
+    path = apteryx_node_path (node->parent);
+    if (collect->config_only)
     {
-        _check_exist ((char *) iter->data, &err_tag, false);
-        if (err_tag != NC_ERR_TAG_UNKNOWN)
+        sch_node *schema = sch_lookup (g_schema, path);
+
+        /* Leaves that cannot be read back are never in an exported file */
+        if (!schema || !sch_is_writable (schema) || !sch_is_readable (schema))
         {
-            if (logging & LOG_EDIT_CONFIG)
-            {
-                gchar *err_msg = NULL;
-                err_msg = g_strdup_printf ("EDIT_CONFIG: error while creating path %s - %s\n",
-                                           (char *) iter->data,
-                                           rpc_error_tag_to_string (err_tag));
-                ERROR ("%s\n", err_msg);
-                g_free (err_msg);
-            }
-            ret = send_rpc_error_full (session, rpc, err_tag, NC_ERR_TYPE_APP, NULL, NULL, NULL, true);
-            sch_parm_free (parms);
-            apteryx_free_tree (tree);
-            return ret;
+            g_free (path);
+            return FALSE;
         }
     }
+    g_hash_table_replace (collect->leaves, path, g_strdup (node->data ? (char *) node->data : ""));
+    return FALSE;
+}
 
-    /* Delete delete, remove and replace paths */
-    for (iter = sch_parm_deletes (parms); iter; iter = g_list_next (iter))
+/* Work out what it takes to make the config under a top level root match tree,
+ * which is NULL if the root is to have no config at all. Leaves that already
+ * have the right value are left out. Returns NULL if nothing needs to change */
+static GNode *
+import_root_diff (const char *root, GNode *tree)
+{
+    import_leaves old = { g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free), true };
+    import_leaves new = { g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free), false };
+    GNode *existing = apteryx_get_tree (root);
+    GNode *diff = APTERYX_NODE (NULL, g_strdup (root));
+    GHashTableIter hiter;
+    gpointer key, value;
+
+    if (existing)
+        g_node_traverse (existing, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1, import_leaf, &old);
+    apteryx_free_tree (existing);
+    if (tree)
+        g_node_traverse (tree, G_PRE_ORDER, G_TRAVERSE_LEAVES, -1, import_leaf, &new);
+
+    g_hash_table_iter_init (&hiter, new.leaves);
+    while (g_hash_table_iter_next (&hiter, &key, &value))
     {
-        apteryx_prune (iter->data);
+        if (g_strcmp0 (g_hash_table_lookup (old.leaves, key), value) != 0)
+            APTERYX_NODE (tree_path_node (diff, key, true), g_strdup (value));
     }
-    for (iter = sch_parm_removes (parms); iter; iter = g_list_next (iter))
+    g_hash_table_iter_init (&hiter, old.leaves);
+    while (g_hash_table_iter_next (&hiter, &key, NULL))
     {
-        apteryx_prune (iter->data);
+        if (!g_hash_table_contains (new.leaves, key))
+            APTERYX_NODE (tree_path_node (diff, key, true), g_strdup (""));
     }
-    for (iter = sch_parm_replaces (parms); iter; iter = g_list_next (iter))
+    g_hash_table_destroy (old.leaves);
+    g_hash_table_destroy (new.leaves);
+
+    if (!diff->children)
     {
-        apteryx_prune (iter->data);
+        apteryx_free_tree (diff);
+        diff = NULL;
     }
+    return diff;
+}
 
-    //TODO - permissions
-    //TODO - patterns
+/* Add the difference for one top level root to the change for the whole import */
+static void
+import_add_diff (GNode *change, GNode *diff)
+{
+    gchar *name = g_strdup (APTERYX_NAME (diff) + 1);
 
-    /* For a create make sure the data does not already exist */
-    for (iter = sch_parm_creates (parms); iter; iter = g_list_next (iter))
+    g_free (diff->data);
+    diff->data = name;
+    g_node_append (change, diff);
+}
+
+/* Decode the config in a file one top level subtree at a time, adding what
+ * differs from running to change. Returns the error for the first subtree that
+ * could not be decoded, or that fails a condition */
+static NC_ERR_TAG
+import_file (const char *path, GNode *change)
+{
+    GHashTable *seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    NC_ERR_TAG err_tag = NC_ERR_TAG_UNKNOWN;
+    xmlTextReader *reader = NULL;
+    GMappedFile *map;
+    GList *paths;
+    int depth;
+    int r;
+
+    map = g_mapped_file_new (path, FALSE, NULL);
+    if (map && g_mapped_file_get_length (map))
+        reader = xmlReaderForMemory (g_mapped_file_get_contents (map), g_mapped_file_get_length (map),
+                                     NULL, NULL, XML_PARSE_NONET);
+    if (!reader)
+    {
+        ERROR ("IMPORT: Failed to read \"%s\"\n", path);
+        if (map)
+            g_mapped_file_unref (map);
+        g_hash_table_destroy (seen);
+        return NC_ERR_TAG_OPR_FAILED;
+    }
+
+    /* Find the <config> element */
+    do
+        r = xmlTextReaderRead (reader);
+    while (r == 1 && xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT);
+    if (r != 1 || xmlStrcmp (xmlTextReaderConstLocalName (reader), BAD_CAST "config") != 0)
+        err_tag = NC_ERR_TAG_MALFORMED_MSG;
+    depth = xmlTextReaderDepth (reader);
+    if (err_tag == NC_ERR_TAG_UNKNOWN && !xmlTextReaderIsEmptyElement (reader))
+        r = xmlTextReaderRead (reader);
+    else
+        r = 0;
+
+    /* Only the subtree being decoded is expanded, the reader frees each as it moves on */
+    while (err_tag == NC_ERR_TAG_UNKNOWN && r == 1 && xmlTextReaderDepth (reader) > depth)
     {
-        exists = apteryx_get ((char *) iter->data);
-        if (exists)
+        sch_xml_to_gnode_parms parms;
+        xmlNode *node;
+        GNode *tree;
+        GNode *diff;
+
+        if (xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT)
+        {
+            r = xmlTextReaderRead (reader);
+            continue;
+        }
+        node = xmlTextReaderExpand (reader);
+        if (!node)
+        {
+            err_tag = NC_ERR_TAG_MALFORMED_MSG;
+            break;
+        }
+
+        parms = sch_xml_to_gnode (g_schema, NULL, node, 0, NC_OP_MERGE, true, false, NULL);
+        tree = sch_parm_tree (parms);
+        if (sch_parm_error (parms).tag != 0 || !tree ||
+            g_hash_table_contains (seen, APTERYX_NAME (tree)))
         {
-            g_free (exists);
-            ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_DATA_EXISTS, NC_ERR_TYPE_APP, NULL, NULL, NULL, true);
+            ERROR ("IMPORT: Invalid \"%s\" in \"%s\"\n", (char *) node->name, path);
+            err_tag = sch_parm_error (parms).tag ? sch_parm_error (parms).tag : NC_ERR_TAG_INVALID_VAL;
             apteryx_free_tree (tree);
             sch_parm_free (parms);
-            return ret;
+            break;
         }
-    }
-
-    /* Loop through conditions which are stored in the list as path, condition, path, condition, ... */
-    for (iter = sch_parm_conditions (parms); iter; iter = g_list_next (iter))
-    {
-        GList *next = g_list_next (iter);
+        g_hash_table_add (seen, g_strdup (APTERYX_NAME (tree)));
 
-        if (next && !sch_process_condition (g_schema, tree, (char *) iter->data, (char *) next->data))
+        diff = import_root_diff (APTERYX_NAME (tree), tree);
+        for (GList *iter = sch_parm_conditions (parms); diff && iter; iter = g_list_next (iter))
         {
-            if (logging & LOG_EDIT_CONFIG)
+            sch_condition *cond = (sch_condition *) iter->data;
+
+            if (!sch_process_condition (g_schema, diff, cond->path, cond->condition))
             {
-                ERROR ("EDIT-CONFIG: Path <%s> failed condition <%s>\n", (char *) iter->data, (char *) next->data);
+                ERROR ("IMPORT: Path <%s> failed condition <%s>\n", cond->path, cond->condition);
+                err_tag = NC_ERR_TAG_INVALID_VAL;
+                break;
             }
-            ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL, NULL, NULL, NULL, true);
-            sch_parm_free (parms);
-            apteryx_free_tree (tree);
-            return ret;
         }
-        iter = next;
+        if (diff && err_tag == NC_ERR_TAG_UNKNOWN)
+            import_add_diff (change, diff);
+        else
+            apteryx_free_tree (diff);
+        apteryx_free_tree (tree);
+        sch_parm_free (parms);
+        r = xmlTextReaderNext (reader);
     }
+    if (r < 0 && err_tag == NC_ERR_TAG_UNKNOWN)
+        err_tag = NC_ERR_TAG_MALFORMED_MSG;
+    xmlFreeTextReader (reader);
+    g_mapped_file_unref (map);
 
-    /* Edit database */
-    DEBUG ("NETCONF: SET %s need_set %d\n", tree ? APTERYX_NAME (tree) : "NULL", sch_parm_need_tree_set (parms));
-    if (tree && sch_parm_need_tree_set (parms) && !apteryx_set_tree (tree))
+    /* Config under any other modelled root is removed */
+    paths = err_tag == NC_ERR_TAG_UNKNOWN ? apteryx_search ("/") : NULL;
+    for (GList *iter = paths; iter; iter = g_list_next (iter))
     {
-        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP, NULL, NULL, NULL, true);
-        apteryx_free_tree (tree);
-        sch_parm_free (parms);
-        return ret;
+        const char *root = (const char *) iter->data;
+        GNode *diff;
+
+        if (g_hash_table_contains (seen, root) || !sch_lookup (g_schema, root))
+            continue;
+        diff = import_root_diff (root, NULL);
+        if (diff)
+            import_add_diff (change, diff);
     }
+    g_list_free_full (paths, free);
+    g_hash_table_destroy (seen);
+    return err_tag;
+}
 
-    if ((logging & LOG_EDIT_CONFIG))
+/* Find the file named by a file:// URL, which must be in the export directory */
+static gchar *
+import_url_path (const char *url)
+{
+    gchar *path = url ? g_filename_from_uri (url, NULL, NULL) : NULL;
+    gchar *dir = NULL;
+    gchar *name = NULL;
+    char *real_dir = NULL;
+    char *real_export = NULL;
+    struct stat st;
+    bool ok;
+
+    if (!path || !export_path)
     {
-        char *value;
+        g_free (path);
+        return NULL;
+    }
+    dir = g_path_get_dirname (path);
+    name = g_path_get_basename (path);
+    real_dir = realpath (dir, NULL);
+    real_export = realpath (export_path, NULL);
+    ok = real_dir && real_export && g_strcmp0 (real_dir, real_export) == 0 && name[0] != '.' &&
+         lstat (path, &st) == 0 && S_ISREG (st.st_mode);
+    free (real_export);
+    free (real_dir);
+    g_free (name);
+    g_free (dir);
+    if (!ok)
+    {
+        g_free (path);
+        path = NULL;
+    }
+    return path;
+}
 
-        for (iter = sch_parm_deletes (parms); iter; iter = g_list_next (iter))
-        {
-            NOTICE ("EDIT-CONFIG: %s@%s id:%d delete:%s\n",
-                    session->username, session->rem_addr, session->id, (char *) iter->data);
-        }
-        for (iter = sch_parm_removes (parms); iter; iter = g_list_next (iter))
-        {
-            NOTICE ("EDIT-CONFIG: %s@%s id:%d remove:%s\n",
-                    session->username, session->rem_addr, session->id, (char *) iter->data);
-        }
-        for (iter = sch_parm_creates (parms); iter; iter = g_list_next (iter))
-        {
-            value = split_path_value ((char *) iter->data);
-            NOTICE ("EDIT-CONFIG: %s@%s id:%d create:%s=%s\n",
-                    session->username, session->rem_addr, session->id,
-                    (char *) iter->data, value);
-        }
-        for (iter = sch_parm_merges (parms); iter; iter = g_list_next (iter))
-        {
-            value = split_path_value ((char *) iter->data);
-            NOTICE ("EDIT-CONFIG: %s@%s id:%d merge:%s=%s\n",
-                    session->username, session->rem_addr, session->id,
-                    (char *) iter->data, value);
-        }
-        for (iter = sch_parm_replaces (parms); iter; iter = g_list_next (iter))
-        {
-            value = split_path_value ((char *) iter->data);
-            NOTICE ("EDIT-CONFIG: %s@%s id:%d replace:%s=%s\n",
-                    session->username, session->rem_addr, session->id,
-                    (char *) iter->data, value);
-        }
+/* Replace running with the config in a file. Only what differs is written, in
+ * one transaction */
+static bool
+handle_copy_url (struct netconf_session *session, xmlNode * rpc, xmlNode * source)
+{
+    char *url = (char *) xmlNodeGetContent (source);
+    gchar *path = import_url_path (url ? g_strstrip (url) : NULL);
+    NC_ERR_TAG err_tag;
+    GNode *change;
+
+    if (!path)
+    {
+        VERBOSE ("Copy from \"%s\" not allowed\n", url ? url : "");
+        free (url);
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                                    "Invalid source URL", NULL, NULL, true);
     }
+    free (url);
 
-    sch_parm_free (parms);
-    apteryx_free_tree (tree);
+    /* Validate lock if configured on the running datastore */
+    if (running_ds_lock.locked == TRUE && session->id != running_ds_lock.nc_sess.id)
+    {
+        VERBOSE ("Copy failed, lock is already held\n");
+        g_free (path);
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
+                                    "Lock is already held", NULL, NULL, false);
+    }
+
+    if (logging & LOG_EDIT_CONFIG)
+        NOTICE ("COPY-CONFIG: %s@%s id:%u %s->running\n",
+                session->username, session->rem_addr, session->id, path);
+
+    change = APTERYX_NODE (NULL, g_strdup ("/"));
+    err_tag = import_file (path, change);
+    g_free (path);
+    if (err_tag == NC_ERR_TAG_UNKNOWN && change->children && !running_set_tree (change))
+        err_tag = NC_ERR_TAG_OPR_FAILED;
+    if (err_tag != NC_ERR_TAG_UNKNOWN)
+    {
+        apteryx_free_tree (change);
+        return send_rpc_error_full (session, rpc, err_tag,
+                                    err_tag == NC_ERR_TAG_OPR_FAILED ? NC_ERR_TYPE_APP : NC_ERR_TYPE_PROTOCOL,
+                                    NULL, NULL, NULL, true);
+    }
+    DEBUG ("NETCONF: COPY %d roots changed\n", g_node_n_children (change));
+    apteryx_free_tree (change);
 
     /* Success */
     session->counters.in_rpcs++;
@@ -2225,38 +5293,80 @@ handle_edit (struct netconf_session *session, xmlNode * rpc)
     return send_rpc_ok (session, rpc, false);
 }
 
-static void
-set_lock (struct netconf_session *session)
-{
-    running_ds_lock.locked = TRUE;
-    running_ds_lock.nc_sess.id = session->id;
-    running_ds_lock.nc_sess.fd = session->fd;
-}
-
 static bool
-handle_lock (struct netconf_session *session, xmlNode * rpc)
+handle_copy_config (struct netconf_session *session, xmlNode * rpc)
 {
-    xmlNode *action = xmlFirstElementChild (rpc);
-    xmlNode *node;
-    bool ret = true;
+    xmlNode *target;
+    xmlNode *source;
+    bool ret;
 
-    /* Check the target */
-    node = xmlFindNodeByName (action, BAD_CAST "target");
-    if (!node)
+    target = rpc_datastore (session, rpc, "target");
+    if (!target)
+        return false;
+    source = rpc_datastore (session, rpc, "source");
+    if (!source)
+        return false;
+
+    /* Restore running from a file */
+    if (target_ds_lock (target) == &running_ds_lock && xmlStrcmp (source->name, BAD_CAST "url") == 0)
+        return handle_copy_url (session, rpc, source);
+
+    /* Otherwise saving running is the only copy there is a use for */
+    if (target_ds_lock (target) != &startup_ds_lock ||
+        xmlStrcmp (source->name, BAD_CAST "running") != 0)
     {
-        VERBOSE ("Missing \"target\" element\n");
-        ret =
-            send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ELEM,
-                                 NC_ERR_TYPE_PROTOCOL, "Missing target element", "target",
-                                 NULL, false);
+        gchar *error_msg = g_strdup_printf ("Copy from \"%s\" to \"%s\" not supported",
+                                            (char *) source->name, (char *) target->name);
+
+        VERBOSE ("%s\n", error_msg);
+        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
+                                   error_msg, NULL, NULL, true);
+        g_free (error_msg);
         return ret;
     }
-    xmlNodePtr child = xmlFirstElementChild (node);
-    if (!child ||
-        xmlStrcmp (child->name, BAD_CAST "running"))
+
+    /* Validate lock if configured on the startup datastore */
+    if (startup_ds_lock.locked == TRUE && session->id != startup_ds_lock.nc_sess.id)
+    {
+        VERBOSE ("Copy failed, lock is already held\n");
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
+                                    "Lock is already held", NULL, NULL, false);
+    }
+
+    if (logging & LOG_EDIT_CONFIG)
+        NOTICE ("COPY-CONFIG: %s@%s id:%u running->startup\n",
+                session->username, session->rem_addr, session->id);
+
+    g_mutex_lock (&startup_lock);
+    ret = startup_commit ();
+    g_mutex_unlock (&startup_lock);
+    if (!ret)
+    {
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP,
+                                    "Failed to save startup datastore", NULL, NULL, true);
+    }
+
+    /* Success */
+    session->counters.in_rpcs++;
+    netconf_global_stats.session_totals.in_rpcs++;
+    return send_rpc_ok (session, rpc, false);
+}
+
+static bool
+handle_delete_config (struct netconf_session *session, xmlNode * rpc)
+{
+    xmlNode *target;
+    bool ret;
+
+    target = rpc_datastore (session, rpc, "target");
+    if (!target)
+        return false;
+
+    /* Running and candidate cannot be deleted */
+    if (target_ds_lock (target) != &startup_ds_lock)
     {
-        gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported",
-                                            child ? (char *) child->name : "null");
+        gchar *error_msg = g_strdup_printf ("Delete of \"%s\" not supported", (char *) target->name);
+
         VERBOSE ("%s\n", error_msg);
         ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED, NC_ERR_TYPE_PROTOCOL,
                                    error_msg, NULL, NULL, true);
@@ -2264,25 +5374,38 @@ handle_lock (struct netconf_session *session, xmlNode * rpc)
         return ret;
     }
 
-    /* Attempt to acquire lock */
-    if (running_ds_lock.locked == FALSE)
+    /* Validate lock if configured on the startup datastore */
+    if (startup_ds_lock.locked == TRUE && session->id != startup_ds_lock.nc_sess.id)
     {
-        /* Acquire lock on the running datastore */
-        set_lock (session);
+        VERBOSE ("Delete failed, lock is already held\n");
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_IN_USE, NC_ERR_TYPE_APP,
+                                    "Lock is already held", NULL, NULL, false);
     }
-    else
+
+    if (logging & LOG_EDIT_CONFIG)
+        NOTICE ("DELETE-CONFIG: %s@%s id:%u startup\n",
+                session->username, session->rem_addr, session->id);
+
+    g_mutex_lock (&startup_lock);
+    ret = unlink (startup_path) == 0 || errno == ENOENT;
+    if (!ret)
     {
-        /* Return lock-denied */
-        gchar *error_msg = g_strdup_printf ("Lock is already held by session id %d",
-                                            running_ds_lock.nc_sess.id);
-        VERBOSE ("%s\n", error_msg);
-        ret =  send_rpc_error_full (session, rpc, NC_ERR_TAG_LOCK_DENIED, NC_ERR_TYPE_PROTOCOL,
-                                    error_msg, NULL, NULL, false);
-        g_free (error_msg);
-        return ret;
+        ERROR ("STARTUP: Failed to remove \"%s\" (%s)\n", startup_path, strerror (errno));
+    }
+    else if (startup_journal)
+    {
+        /* Nothing left to add to until the next snapshot */
+        unlink (startup_journal);
+        g_free (startup_base);
+        startup_base = NULL;
+        g_hash_table_remove_all (startup_dirty);
+    }
+    g_mutex_unlock (&startup_lock);
+    if (!ret)
+    {
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP,
+                                    "Failed to delete startup datastore", NULL, NULL, true);
     }
-    if ((logging & LOG_LOCK))
-        NOTICE ("LOCK: %s@%s id:%d\n", session->username, session->rem_addr, session->id);
 
     /* Success */
     session->counters.in_rpcs++;
@@ -2290,77 +5413,95 @@ handle_lock (struct netconf_session *session, xmlNode * rpc)
     return send_rpc_ok (session, rpc, false);
 }
 
-static void
-reset_lock (void)
-{
-    running_ds_lock.locked = FALSE;
-    running_ds_lock.nc_sess.id = 0;
-    running_ds_lock.nc_sess.fd = -1;
-}
-
+/* Stream running config to a descriptor passed with the request, or a file in
+ * the export directory, replying with just the size and checksum written */
 static bool
-handle_unlock (struct netconf_session *session, xmlNode * rpc)
+handle_export (struct netconf_session *session, xmlNode * rpc)
 {
     xmlNode *action = xmlFirstElementChild (rpc);
-    xmlNode *node;
-    bool ret = false;
+    config_stream stream = { -1, NULL, 0 };
+    xmlNode *reply;
+    xmlDoc *doc;
+    gchar *bytes;
+    bool ret;
 
-    /* Check the target */
-    node = xmlFindNodeByName (action, BAD_CAST "target");
-    if (!node)
+    /* Anyone further away should use get-config */
+    if (!session->local)
     {
-        VERBOSE ("Missing \"target\" element\n");
-        ret =
-            send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ELEM,
-                                 NC_ERR_TYPE_PROTOCOL, "Missing target element", "target",
-                                 NULL, false);
-        return ret;
+        VERBOSE ("Export refused for remote session\n");
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_ACCESS_DENIED, NC_ERR_TYPE_APP,
+                                    "Export is only available to local sessions", NULL, NULL, true);
     }
-    xmlNodePtr child = xmlFirstElementChild (node);
-    if (!child || xmlStrcmp (child->name, BAD_CAST "running"))
+
+    if (xmlFindNodeByName (action, BAD_CAST "fd"))
     {
-        gchar *error_msg = g_strdup_printf ("Datastore \"%s\" not supported",
-                                            child ? (char *) child->name : "null");
-        VERBOSE ("%s\n", error_msg);
-        ret =
-            send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_NOT_SUPPORTED,
-                                 NC_ERR_TYPE_PROTOCOL, error_msg, NULL, NULL, false);
-        g_free (error_msg);
-        return ret;
+        if (session->passed_fd < 0)
+        {
+            VERBOSE ("No descriptor passed with export\n");
+            return send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                                        "No file descriptor passed with request", NULL, NULL, true);
+        }
+        stream.fd = session->passed_fd;
+        session->passed_fd = -1;
     }
-
-    /* Check unlock operation validity */
-    if (!running_ds_lock.locked)
+    else if (xmlFindNodeByName (action, BAD_CAST "file"))
     {
-        gchar *error_msg = g_strdup_printf ("Unlock failed, no lock configured on the \"%s\" datastore",
-                                            (char *) xmlFirstElementChild (node)->name);
-        VERBOSE ("%s\n", error_msg);
-        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_PROTOCOL,
-                                   error_msg, NULL, NULL, true);
-        g_free (error_msg);
-        return ret;
+        char *name = (char *) xmlNodeGetContent (xmlFindNodeByName (action, BAD_CAST "file"));
+        gchar *path;
+
+        /* Only plain names, so nothing outside the export directory is touched */
+        if (!export_path || !name || name[0] == '\0' || name[0] == '.' || strchr (name, '/'))
+        {
+            VERBOSE ("Export to \"%s\" not allowed\n", name ? name : "");
+            free (name);
+            return send_rpc_error_full (session, rpc, NC_ERR_TAG_INVALID_VAL, NC_ERR_TYPE_PROTOCOL,
+                                        "Invalid export file", NULL, NULL, true);
+        }
+        path = g_build_filename (export_path, name, NULL);
+        stream.fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (stream.fd < 0)
+            ERROR ("EXPORT: Failed to open \"%s\" (%s)\n", path, strerror (errno));
+        g_free (path);
+        free (name);
+        if (stream.fd < 0)
+        {
+            return send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP,
+                                        "Failed to open export file", NULL, NULL, true);
+        }
     }
-    else if ((running_ds_lock.locked == TRUE) && (session->id != running_ds_lock.nc_sess.id))
+    else
     {
-        /* Lock held by another session */
-        gchar *error_msg = g_strdup_printf ("Unlock failed, session %u does not own the lock", session->id);
-        VERBOSE ("%s\n", error_msg);
-        ret = send_rpc_error_full (session, rpc, NC_ERR_TAG_LOCK_DENIED, NC_ERR_TYPE_PROTOCOL,
-                                   error_msg, NULL, NULL, false);
-        g_free (error_msg);
-        return ret;
+        VERBOSE ("Missing \"fd\" or \"file\" element\n");
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_MISSING_ELEM, NC_ERR_TYPE_PROTOCOL,
+                                    "Missing fd or file element", "file", NULL, false);
     }
 
-    /* Unlock running datastore */
-    reset_lock ();
+    if (logging & LOG_GET_CONFIG)
+        NOTICE ("EXPORT: %s@%s id:%u\n", session->username, session->rem_addr, session->id);
 
-    if ((logging & LOG_UNLOCK))
-        NOTICE ("UNLOCK: %s@%s id:%d\n", session->username, session->rem_addr, session->id);
+    stream.checksum = g_checksum_new (G_CHECKSUM_SHA256);
+    ret = config_stream_running (&stream, NULL);
+    close (stream.fd);
+    if (!ret)
+    {
+        g_checksum_free (stream.checksum);
+        return send_rpc_error_full (session, rpc, NC_ERR_TAG_OPR_FAILED, NC_ERR_TYPE_APP,
+                                    "Failed to write export", NULL, NULL, true);
+    }
 
-    /* Success */
+    doc = create_rpc (BAD_CAST "rpc-reply", xmlGetProp (rpc, BAD_CAST "message-id"));
+    reply = xmlDocGetRootElement (doc);
+    bytes = g_strdup_printf ("%" G_GSIZE_FORMAT, stream.bytes);
+    xmlNewTextChild (reply, NULL, BAD_CAST "bytes", BAD_CAST bytes);
+    xmlNewTextChild (reply, NULL, BAD_CAST "checksum",
+                     BAD_CAST g_checksum_get_string (stream.checksum));
+    ret = send_rpc_reply_doc (session, doc);
+    xmlFreeDoc (doc);
+    g_free (bytes);
+    g_checksum_free (stream.checksum);
     session->counters.in_rpcs++;
     netconf_global_stats.session_totals.in_rpcs++;
-    return send_rpc_ok (session, rpc, false);
+    return ret;
 }
 
 static bool
@@ -2490,7 +5631,11 @@ add_session_data (struct netconf_session *session, uint32_t pid)
         g_date_time_unref (now);
     }
     else
+    {
+        /* Not started by sshd, so running on this host */
         session->rem_addr = g_strdup ("unknown");
+        session->local = true;
+    }
 
 cleanup:
     g_free (contents);
@@ -2522,7 +5667,10 @@ _netconf_sessions_refresh (const char *path)
 
         /* Get lock value for session */
         has_lock = running_ds_lock.locked && nc_session->id == running_ds_lock.nc_sess.id;
-        lock_str = has_lock ? "R" : "-";
+        if (candidate_ds_lock.locked && nc_session->id == candidate_ds_lock.nc_sess.id)
+            lock_str = has_lock ? "RC" : "C";
+        else
+            lock_str = has_lock ? "R" : "-";
 
         /* Create Apteryx sub-tree */
         sess_id = g_strdup_printf ("%d", nc_session->id);
@@ -2645,11 +5793,72 @@ _netconf_max_sessions (const char *path, const char *value)
     return true;
 }
 
+/* Take bytes of the global request memory for a session. False if there is not enough left */
+static bool
+request_memory_take (struct netconf_session *session, uint64_t bytes)
+{
+    bool ret = false;
+
+    g_mutex_lock (&request_lock);
+    if (netconf_request_memory + bytes <= netconf_request_memory_max)
+    {
+        netconf_request_memory += bytes;
+        session->request_memory += bytes;
+        ret = true;
+    }
+    g_mutex_unlock (&request_lock);
+    return ret;
+}
+
+/* Give back everything a session took for its last request */
+static void
+request_memory_release (struct netconf_session *session)
+{
+    g_mutex_lock (&request_lock);
+    netconf_request_memory -= session->request_memory;
+    session->request_memory = 0;
+    g_mutex_unlock (&request_lock);
+}
+
+static bool
+_netconf_max_request (const char *path, const char *value)
+{
+    uint32_t max_request;
+
+    if (!value || strlen (value) == 0)
+    {
+        max_request = netconf_max_request_def;
+    }
+    else
+    {
+        uint64_t size = g_ascii_strtoull (value, NULL, 10);
+        if (size < NETCONF_MAX_REQUEST_MIN)
+        {
+            max_request = NETCONF_MAX_REQUEST_MIN;
+        }
+        else if (size > NETCONF_MAX_REQUEST_MAX)
+        {
+            max_request = NETCONF_MAX_REQUEST_MAX;
+        }
+        else
+        {
+            max_request = size;
+        }
+    }
+    if (netconf_max_request != max_request)
+    {
+        netconf_max_request = max_request;
+        apteryx_set_int (NETCONF_STATE, "max-request-size", netconf_max_request);
+    }
+    return true;
+}
+
 static struct netconf_session *
 create_session (int fd)
 {
     struct netconf_session *session = g_malloc0 (sizeof (struct netconf_session));
     session->fd = fd;
+    session->passed_fd = -1;
     session->running = g_main_loop_is_running (g_loop);
 
     g_mutex_lock (&session_lock);
@@ -2673,15 +5882,36 @@ create_session (int fd)
 static void
 destroy_session (struct netconf_session *session)
 {
+    /* Edits that were accepted are still applied */
+    coalesce_flush (session, true);
+
     if (session->fd >= 0)
     {
         close (session->fd);
         session->fd = -1;
     }
+    if (session->passed_fd >= 0)
+    {
+        close (session->passed_fd);
+        session->passed_fd = -1;
+    }
+    request_memory_release (session);
+    if (session->parser)
+        xmlFreeParserCtxt (session->parser);
+    session->parser = NULL;
 
     if (session->id == running_ds_lock.nc_sess.id)
     {
-        reset_lock ();
+        reset_lock (&running_ds_lock);
+    }
+    if (session->id == candidate_ds_lock.nc_sess.id)
+    {
+        reset_lock (&candidate_ds_lock);
+        candidate_discard ();
+    }
+    if (session->id == startup_ds_lock.nc_sess.id)
+    {
+        reset_lock (&startup_ds_lock);
     }
 
     remove_netconf_session (session);
@@ -2694,6 +5924,43 @@ destroy_session (struct netconf_session *session)
     g_free (session);
 }
 
+/* Receive exactly len bytes, keeping hold of any descriptor passed with them.
+ * The kernel ends a read early at a descriptor, so keep reading until done */
+static bool
+session_recv (struct netconf_session *session, char *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        char control[CMSG_SPACE (sizeof (int))];
+        struct iovec iov = { buf + done, len - done };
+        struct msghdr msg = { 0 };
+        struct cmsghdr *cmsg;
+        ssize_t n;
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof (control);
+        n = recvmsg (session->fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0)
+            return false;
+        for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                cmsg->cmsg_len == CMSG_LEN (sizeof (int)))
+            {
+                if (session->passed_fd >= 0)
+                    close (session->passed_fd);
+                memcpy (&session->passed_fd, CMSG_DATA (cmsg), sizeof (int));
+            }
+        }
+        done += n;
+    }
+    return true;
+}
+
 /* \n#<chunk-size>\n with max chunk-size = 4294967295 */
 #define MAX_CHUNK_HEADER_SIZE 13
 
@@ -2708,7 +5975,7 @@ read_chunk_size (struct netconf_session *session)
     /* Read chunk-size (\n#<chunk-size>\n */
     while ((session->running = g_main_loop_is_running (g_loop)))
     {
-        if (len >= MAX_CHUNK_HEADER_SIZE || recv (session->fd, pt, 1, 0) != 1)
+        if (len >= MAX_CHUNK_HEADER_SIZE || !session_recv (session, pt, 1))
         {
             ERROR ("RX Failed to read chunk header byte\n");
             break;
@@ -2732,10 +5999,45 @@ read_chunk_size (struct netconf_session *session)
     return chunk_len;
 }
 
-static char *
-receive_message (struct netconf_session *session, int *rlen)
+/* Read count bytes of a chunk straight into the push parser */
+static bool
+receive_stream (struct netconf_session *session, xmlParserCtxt *ctxt, int count)
+{
+    char *buffer = g_malloc (MIN (count, RX_STREAM_SIZE));
+    bool ret = true;
+
+    while (ret && count > 0)
+    {
+        int len = MIN (count, RX_STREAM_SIZE);
+
+        if (!session_recv (session, buffer, len))
+        {
+            ERROR ("RX Failed to read %d bytes of chunk\n", len);
+            ret = false;
+        }
+        else
+        {
+            VERBOSE ("RX(%d):\n%.*s\n", len, len, buffer);
+            if (xmlParseChunk (ctxt, buffer, len, 0) != 0)
+            {
+                ERROR ("XML: Invalid Netconf message\n");
+                ret = false;
+            }
+        }
+        count -= len;
+    }
+    g_free (buffer);
+    return ret;
+}
+
+static xmlDoc *
+receive_message (struct netconf_session *session)
 {
+    xmlParserCtxt *ctxt = NULL;
+    xmlDoc *doc = NULL;
     char *message = NULL;
+    bool complete = false;
+    int held = 0;
     int len = 0;
 
     /* Read chunks until we get the end of message marker */
@@ -2747,49 +6049,96 @@ receive_message (struct netconf_session *session, int *rlen)
         chunk_len = read_chunk_size (session);
         if (!session->running)
         {
-            g_free (message);
-            message = NULL;
-            len = 0;
             break;
         }
 
         if (!chunk_len)
         {
             /* End of message */
+            complete = len > 0;
             break;
         }
-        else if (chunk_len < 0 || chunk_len > MAX_REQUEST_MESSAGE_SIZE - len)
+        else if (chunk_len < 0 || (int64_t) len + chunk_len > netconf_max_request)
         {
             gchar *error_msg = g_strdup ("NETCONF: The request is too large for the implementation to handle.");
             VERBOSE ("%s\n", error_msg);
             send_rpc_error_full (session, NULL, NC_ERR_TAG_TOO_BIG, NC_ERR_TYPE_APP, error_msg,
                                  NULL, NULL, true);
             g_free (error_msg);
+            break;
+        }
+        else if (!request_memory_take (session, chunk_len))
+        {
+            gchar *error_msg = g_strdup ("NETCONF: Not enough memory to receive the request.");
+            VERBOSE ("%s\n", error_msg);
+            send_rpc_error_full (session, NULL, NC_ERR_TAG_RESOURCE_DENIED, NC_ERR_TYPE_APP,
+                                 error_msg, NULL, NULL, true);
+            g_free (error_msg);
+            break;
+        }
+
+        /* Large requests go to the parser as they arrive, starting with what is held so far */
+        if (!ctxt && held + chunk_len > RX_STREAM_SIZE)
+        {
+            ctxt = session_parser (session);
+            if (!ctxt || xmlCtxtResetPush (ctxt, NULL, 0, NULL, NULL) != 0)
+            {
+                ERROR ("XML: Failed to create parser\n");
+                ctxt = NULL;
+                break;
+            }
+            xmlCtxtUseOptions (ctxt, NETCONF_PARSE_OPTIONS);
+            if (held && xmlParseChunk (ctxt, message, held, 0) != 0)
+            {
+                ERROR ("XML: Invalid Netconf message\n");
+                break;
+            }
             g_free (message);
             message = NULL;
-            len = 0;
-            break;
+            held = 0;
+        }
+        if (ctxt)
+        {
+            if (!receive_stream (session, ctxt, chunk_len))
+                break;
+            len += chunk_len;
+            continue;
         }
 
         /* Read chunk */
         if (!message)
             message = g_malloc (chunk_len);
         else
-            message = g_realloc (message, len + chunk_len);
-        if (recv (session->fd, message + len, chunk_len, MSG_WAITALL) != chunk_len)
+            message = g_realloc (message, held + chunk_len);
+        if (!session_recv (session, message + held, chunk_len))
         {
             ERROR ("RX Failed to read %d bytes of chunk\n", chunk_len);
-            g_free (message);
-            message = NULL;
-            len = 0;
             break;
         }
-        VERBOSE ("RX(%d):\n%.*s\n", chunk_len, chunk_len, message + len);
+        VERBOSE ("RX(%d):\n%.*s\n", chunk_len, chunk_len, message + held);
+        held += chunk_len;
         len += chunk_len;
     }
 
-    *rlen = len;
-    return message;
+    /* Parse RPC */
+    if (ctxt)
+    {
+        if (complete && xmlParseChunk (ctxt, NULL, 0, 1) == 0 && ctxt->wellFormed)
+            doc = ctxt->myDoc;
+        else
+            xmlFreeDoc (ctxt->myDoc);
+        ctxt->myDoc = NULL;
+    }
+    else if (complete)
+    {
+        doc = parse_message (session, message, held);
+    }
+    g_free (message);
+    if (complete && !doc)
+    {
+        ERROR ("XML: Invalid Netconf message\n");
+    }
+    return doc;
 }
 
 void *
@@ -2851,23 +6200,12 @@ netconf_handle_session (int fd)
     {
         xmlDoc *doc = NULL;
         xmlNode *rpc, *child;
-        char *message;
-        int len;
-
-        /* Receive message */
-        message = receive_message (session, &len);
-        if (!session->running || !message)
-        {
-            netconf_global_stats.dropped_sessions++;
-            break;
-        }
 
-        /* Parse RPC */
-        doc = xmlParseMemory (message, len);
-        if (!doc)
+        /* Receive and parse message */
+        doc = receive_message (session);
+        if (!session->running || !doc)
         {
-            ERROR ("XML: Invalid Netconf message\n");
-            g_free (message);
+            xmlFreeDoc (doc);
             netconf_global_stats.dropped_sessions++;
             break;
         }
@@ -2876,7 +6214,6 @@ netconf_handle_session (int fd)
         {
             ERROR ("XML: No root RPC element\n");
             xmlFreeDoc (doc);
-            g_free (message);
             netconf_global_stats.dropped_sessions++;
             break;
         }
@@ -2887,11 +6224,14 @@ netconf_handle_session (int fd)
         {
             ERROR ("XML: No RPC child element\n");
             xmlFreeDoc (doc);
-            g_free (message);
             netconf_global_stats.dropped_sessions++;
             break;
         }
 
+        /* Anything but another edit must see the edits held back so far */
+        if (g_strcmp0 ((char *) child->name, "edit-config") != 0)
+            coalesce_flush (session, false);
+
         /* Check whether the <rpc> element has the mandatory attribute - "message-id "*/
         if (!xmlHasProp (rpc, BAD_CAST "message-id"))
         {
@@ -2899,7 +6239,6 @@ netconf_handle_session (int fd)
                                  "RPC missing message-id attribute",
                                  "rpc", "message-id", false);
             xmlFreeDoc (doc);
-            g_free (message);
             netconf_global_stats.dropped_sessions++;
             break;
         }
@@ -2912,7 +6251,6 @@ netconf_handle_session (int fd)
                         session->username, session->rem_addr, session->id);
             send_rpc_ok (session, rpc, true);
             xmlFreeDoc (doc);
-            g_free (message);
             session->counters.in_rpcs++;
             netconf_global_stats.session_totals.in_rpcs++;
             break;
@@ -2937,6 +6275,17 @@ netconf_handle_session (int fd)
             VERBOSE ("Handle RPC %s\n", (char *) child->name);
             handle_edit (session, rpc);
         }
+        else if (g_strcmp0 ((char *) child->name, "validate") == 0)
+        {
+            VERBOSE ("Handle RPC %s\n", (char *) child->name);
+            handle_validate (session, rpc);
+        }
+        else if (g_strcmp0 ((char *) child->name, "get-changes") == 0 && child->ns &&
+                 g_strcmp0 ((char *) child->ns->href, NETCONF_CHANGES_NS) == 0)
+        {
+            VERBOSE ("Handle RPC %s\n", (char *) child->name);
+            handle_get_changes (session, rpc);
+        }
         else if (g_strcmp0 ((char *) child->name, "lock") == 0)
         {
             VERBOSE ("Handle RPC %s\n", (char *) child->name);
@@ -2947,6 +6296,31 @@ netconf_handle_session (int fd)
             VERBOSE ("Handle RPC %s\n", (char *) child->name);
             handle_unlock (session, rpc);
         }
+        else if (g_strcmp0 ((char *) child->name, "commit") == 0)
+        {
+            VERBOSE ("Handle RPC %s\n", (char *) child->name);
+            handle_commit (session, rpc);
+        }
+        else if (g_strcmp0 ((char *) child->name, "discard-changes") == 0)
+        {
+            VERBOSE ("Handle RPC %s\n", (char *) child->name);
+            handle_discard_changes (session, rpc);
+        }
+        else if (g_strcmp0 ((char *) child->name, "copy-config") == 0)
+        {
+            VERBOSE ("Handle RPC %s\n", (char *) child->name);
+            handle_copy_config (session, rpc);
+        }
+        else if (g_strcmp0 ((char *) child->name, "delete-config") == 0)
+        {
+            VERBOSE ("Handle RPC %s\n", (char *) child->name);
+            handle_delete_config (session, rpc);
+        }
+        else if (g_strcmp0 ((char *) child->name, "export") == 0)
+        {
+            VERBOSE ("Handle RPC %s\n", (char *) child->name);
+            handle_export (session, rpc);
+        }
         else
         {
             gchar *error_msg = g_strdup_printf ("Unknown RPC (%s)", child->name);
@@ -2955,13 +6329,19 @@ netconf_handle_session (int fd)
                                  error_msg, NULL, NULL, true);
             g_free (error_msg);
             xmlFreeDoc (doc);
-            g_free (message);
             netconf_global_stats.dropped_sessions++;
             break;
         }
 
+        /* A descriptor is only good for the request it came with */
+        if (session->passed_fd >= 0)
+        {
+            close (session->passed_fd);
+            session->passed_fd = -1;
+        }
+
         xmlFreeDoc (doc);
-        g_free (message);
+        request_memory_release (session);
     }
 
     VERBOSE ("NETCONF: session terminated\n");
@@ -2969,8 +6349,32 @@ netconf_handle_session (int fd)
     return NULL;
 }
 
+/* Apply the startup datastore, the snapshot and any journal saved on top of
+ * it, to running */
+static bool
+startup_apply (void)
+{
+    GList *roots = NULL;
+    bool ret;
+
+    ret = startup_load (&roots);
+    for (GList *iter = roots; iter && ret; iter = g_list_next (iter))
+    {
+        GNode *root = (GNode *) iter->data;
+
+        if (root->children && !running_set_tree (root))
+        {
+            ERROR ("STARTUP: Failed to apply \"%s\"\n", APTERYX_NAME (root));
+            ret = false;
+        }
+    }
+    g_list_free_full (roots, (GDestroyNotify) apteryx_free_tree);
+    return ret;
+}
+
 bool
-netconf_init (const char *path, const char *supported,  const char *cp, const char *rm)
+netconf_init (const char *path, const char *supported, const char *startup,
+              const char *export)
 {
     /* Load Data Models */
     g_schema = sch_load_with_model_list_filename (path, supported);
@@ -2978,13 +6382,17 @@ netconf_init (const char *path, const char *supported,  const char *cp, const ch
     {
         return false;
     }
+    sch_names_init (g_schema);
+    sch_node_info_init (g_schema);
 
     /* Create a random starting session ID */
     srand (time (NULL));
     netconf_session_id = rand () % 32768;
 
-    /* Initialise lock */
-    reset_lock ();
+    /* Initialise locks */
+    reset_lock (&running_ds_lock);
+    reset_lock (&candidate_ds_lock);
+    reset_lock (&startup_ds_lock);
 
     /* Set up Apteryx refresh on session information */
     apteryx_refresh (NETCONF_STATE_SESSIONS_PATH "/*", _netconf_sessions_refresh);
@@ -2992,17 +6400,102 @@ netconf_init (const char *path, const char *supported,  const char *cp, const ch
     apteryx_watch (NETCONF_SESSION_STATUS, _netconf_clear_session);
     apteryx_watch (NETCONF_CONFIG_MAX_SESSIONS, _netconf_max_sessions);
     apteryx_set_int (NETCONF_STATE, "max-sessions", netconf_max_sessions);
+    if (apteryx_netconf_max_request > 0)
+    {
+        netconf_max_request_def = CLAMP (apteryx_netconf_max_request, NETCONF_MAX_REQUEST_MIN,
+                                         NETCONF_MAX_REQUEST_MAX);
+        netconf_max_request = netconf_max_request_def;
+    }
+    apteryx_watch (NETCONF_CONFIG_MAX_REQUEST, _netconf_max_request);
+    apteryx_set_int (NETCONF_STATE, "max-request-size", netconf_max_request);
+    if (apteryx_netconf_max_request_memory > 0)
+        netconf_request_memory_max = MAX (apteryx_netconf_max_request_memory, NETCONF_MAX_REQUEST_MIN);
+
+    /* Track changes to each modeled top level subtree */
+    generation_table = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    generation_applied = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                (GDestroyNotify) generation_applied_free);
+    generation_nonce = g_random_int ();
+    for (sch_node *s_node = sch_node_child_first (sch_get_root_schema (g_schema)); s_node;
+         s_node = sch_node_next_sibling (s_node))
+    {
+        char *name = sch_name (s_node);
+        char *watch = g_strdup_printf ("/%s/*", name);
+
+        apteryx_watch_tree (watch, _netconf_generation_watch);
+        generation_watches = g_list_prepend (generation_watches, watch);
+        g_free (name);
+    }
+
+    /* Empty candidate datastore */
+    candidate_conditions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    /* Startup datastore, if there is somewhere to keep it */
+    startup_path = g_strdup (startup);
+    export_path = g_strdup (export);
+    hello_render ();
+    if (startup && apteryx_netconf_journal)
+    {
+        startup_journal = g_strdup_printf ("%s.journal", startup);
+        startup_dirty = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    }
 
     /* Register with the YANG condition parser */
     sch_condition_register (apteryx_netconf_debug, apteryx_netconf_verbose);
 
+    /* Running starts from what was last saved */
+    if (startup && apteryx_netconf_load_startup && !startup_apply ())
+    {
+        ERROR ("STARTUP: Running was not loaded from \"%s\"\n", startup);
+    }
+
     return true;
 }
 
 void
 netconf_shutdown (void)
 {
+    /* Stop tracking changes */
+    for (GList *iter = generation_watches; iter; iter = g_list_next (iter))
+        apteryx_unwatch_tree ((char *) iter->data, _netconf_generation_watch);
+    g_list_free_full (generation_watches, g_free);
+    generation_watches = NULL;
+    for (int i = 0; i < NETCONF_JOURNAL_SIZE; i++)
+    {
+        g_free (change_journal[i].path);
+        change_journal[i].path = NULL;
+    }
+    if (generation_table)
+        g_hash_table_destroy (generation_table);
+    generation_table = NULL;
+    if (generation_applied)
+        g_hash_table_destroy (generation_applied);
+    generation_applied = NULL;
+
+    /* Drop any uncommitted candidate changes */
+    candidate_discard ();
+    if (candidate_conditions)
+        g_hash_table_destroy (candidate_conditions);
+    candidate_conditions = NULL;
+    g_free (startup_path);
+    startup_path = NULL;
+    g_free (export_path);
+    export_path = NULL;
+    g_free (hello_prefix);
+    hello_prefix = NULL;
+    g_free (hello_suffix);
+    hello_suffix = NULL;
+    g_free (startup_journal);
+    startup_journal = NULL;
+    g_free (startup_base);
+    startup_base = NULL;
+    if (startup_dirty)
+        g_hash_table_destroy (startup_dirty);
+    startup_dirty = NULL;
+
     /* Cleanup datamodels */
+    sch_node_info_cache_free ();
+    sch_names_free ();
     if (g_schema)
         sch_free (g_schema);
 }
@@ -142,11 +142,12 @@ fi
 
 # Start netconf
 rm -f $BUILD/apteryx-netconf.sock
+rm -f $BUILD/startup.xml $BUILD/startup.xml.journal
 # TEST_WRAPPER="gdb -ex run --args"
 # TEST_WRAPPER="valgrind --leak-check=full"
 # TEST_WRAPPER="valgrind --tool=cachegrind"
 G_SLICE=always-malloc LD_LIBRARY_PATH=$BUILD/usr/lib \
-        $TEST_WRAPPER ../apteryx-netconf $PARAM -m $BUILD/etc/apteryx/schema/ -l netconf-logging-options --unix $BUILD/apteryx-netconf.sock
+        $TEST_WRAPPER ../apteryx-netconf $PARAM -e -t 4 -f $BUILD/startup.xml -j -x $BUILD -m $BUILD/etc/apteryx/schema/ -l netconf-logging-options --unix $BUILD/apteryx-netconf.sock
 rc=$?; if [[ $rc != 0 ]]; then quit $rc; fi
 sleep 0.5
 cd $BUILD/../
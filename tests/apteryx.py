@@ -59,6 +59,8 @@ c_apteryx_proxy = c_apteryx.apteryx_proxy
 c_apteryx_proxy.restype = ctypes.c_bool
 c_apteryx_unproxy = c_apteryx.apteryx_unproxy
 c_apteryx_unproxy.restype = ctypes.c_bool
+c_apteryx_timestamp = c_apteryx.apteryx_timestamp
+c_apteryx_timestamp.restype = ctypes.c_uint64
 
 
 def set(path, value):
@@ -72,6 +74,10 @@ def get(path):
     return None
 
 
+def timestamp(path):
+    return c_apteryx_timestamp(path.encode('utf-8'))
+
+
 def prune(path):
     return c_apteryx_prune(path.encode('utf-8'))
 
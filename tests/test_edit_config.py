@@ -1,5 +1,5 @@
 import pytest
-from ncclient.operations import RPCError
+from ncclient.operations import RPCError, RaiseMode
 from lxml import etree
 import apteryx
 from conftest import connect
@@ -72,7 +72,7 @@ def test_edit_config_bad_target():
   </test>
 </config>
 """
-    _edit_config_test(payload, targ="candidate",
+    _edit_config_test(payload, targ="startup",
                       expect_err={"tag": "operation-not-supported", "type": "protocol"})
 
 
@@ -493,6 +493,28 @@ def test_edit_config_replace_list_item():
     _edit_config_test(payload, post_xpath="/test/animals/animal[name='cat']", inc_str=["brown"], exc_str=["big"])
 
 
+def test_edit_config_replace_list_item_only_writes_changes():
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+        <animal xc:operation="replace">
+            <name>mouse</name>
+            <type>2</type>
+            <colour>white</colour>
+        </animal>
+    </animals>
+  </test>
+</config>
+"""
+    name_ts = apteryx.timestamp("/test/animals/animal/mouse/name")
+    type_ts = apteryx.timestamp("/test/animals/animal/mouse/type")
+    _edit_config_test(payload, post_xpath="/test/animals/animal[name='mouse']", inc_str=["white"], exc_str=["grey"])
+    assert apteryx.timestamp("/test/animals/animal/mouse/name") == name_ts
+    assert apteryx.timestamp("/test/animals/animal/mouse/type") == type_ts
+
+
 def test_edit_config_replace_all():
     """
     Replace all animals with one (existing) animal.
@@ -618,6 +640,74 @@ def test_edit_config_create_list_item_exists():
     _edit_config_test(payload, expect_err={"tag": "data-exists", "type": "application"})
 
 
+def test_edit_config_create_list_item_exists_without_key():
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+        <animal xc:operation="create">
+            <name>frog</name>
+            <type>little</type>
+        </animal>
+    </animals>
+  </test>
+</config>
+"""
+    # The entry exists even though its key leaf is not stored
+    apteryx.set("/test/animals/animal/frog/colour", "green")
+    _edit_config_test(payload, expect_err={"tag": "data-exists", "type": "application"})
+    delete = payload.replace('"create"', '"delete"').replace("<type>little</type>", "")
+    _edit_config_test(delete, post_xpath="/test/animals", exc_str=["frog", "green"])
+
+
+def test_edit_config_create_many_list_items_one_exists():
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+        <animal xc:operation="create">
+            <name>penguin</name>
+        </animal>
+        <animal xc:operation="create">
+            <name>emu</name>
+        </animal>
+        <animal xc:operation="create">
+            <name>dog</name>
+        </animal>
+    </animals>
+  </test>
+</config>
+"""
+    _edit_config_test(payload, expect_err={"tag": "data-exists", "type": "application"})
+    assert apteryx.get("/test/animals/animal/penguin/name") is None
+    assert apteryx.get("/test/animals/animal/emu/name") is None
+
+
+def test_edit_config_create_and_delete_list_items():
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+        <animal xc:operation="create">
+            <name>penguin</name>
+        </animal>
+        <animal xc:operation="delete">
+            <name>cat</name>
+        </animal>
+        <animal>
+            <name>dog</name>
+            <colour xc:operation="delete"/>
+        </animal>
+    </animals>
+  </test>
+</config>
+"""
+    _edit_config_test(payload, post_xpath="/test/animals", inc_str=["penguin", "dog"], exc_str=["cat", "brown"])
+
+
 def test_edit_config_create_list_item_field():
     payload = """
 <config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
@@ -1056,6 +1146,30 @@ def test_edit_config_when_condition_false():
     _edit_config_test(payload, expect_err={"tag": "invalid-value", "type": "protocol"})
 
 
+def test_edit_config_when_condition_deleted_same_edit():
+    apteryx.set("/test/animals/animal/wombat/name", "wombat")
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+        <animal xc:operation="delete">
+            <name>wombat</name>
+        </animal>
+        <animal>
+            <name>cat</name>
+            <claws>5</claws>
+        </animal>
+    </animals>
+  </test>
+</config>
+"""
+    # The condition is checked against the result of the edit, without wombat
+    _edit_config_test(payload, expect_err={"tag": "invalid-value", "type": "protocol"})
+    assert apteryx.get("/test/animals/animal/wombat/name") == "wombat"
+    assert apteryx.get("/test/animals/animal/cat/claws") is None
+
+
 def test_edit_config_when_name_true():
     payload = """
 <config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
@@ -1198,6 +1312,28 @@ def test_edit_config_must_condition_false():
     _edit_config_test(payload, expect_err={"tag": "invalid-value", "type": "protocol"})
 
 
+def test_edit_config_must_condition_false_nothing_applied():
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+      <animal xc:operation="delete">
+        <name>cat</name>
+      </animal>
+      <animal>
+        <name>dog</name>
+        <friend xc:operation="merge">ben</friend>
+      </animal>
+    </animals>
+  </test>
+</config>
+"""
+    _edit_config_test(payload, expect_err={"tag": "invalid-value", "type": "protocol"})
+    assert apteryx.get("/test/animals/animal/cat/name") == "cat"
+    assert apteryx.get("/test/animals/animal/dog/friend") is None
+
+
 def test_edit_config_leaf_list_invalid_value():
     payload = """
 <config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
@@ -1292,3 +1428,358 @@ def test_edit_config_list_out_of_order_index():
 </config>
 """
     _edit_config_test(payload, post_xpath='/test/animals/animal[name="gerbil"]', inc_str=['gerbil', 'a-types:little'])
+
+
+def test_edit_config_candidate_commit():
+    """
+    Stage two edits in the candidate, check running is untouched until the commit.
+    """
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+      <priority>5</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    m.lock(target='candidate')
+    m.edit_config(target='candidate', config=payload)
+    m.edit_config(target='candidate', config=payload.replace('<priority>5', '<debug>disable</debug><priority>6'))
+    xml = m.get_config(source='candidate', filter=('xpath', '/test/settings')).data
+    assert xml.find('./{*}test/{*}settings/{*}priority').text == '6'
+    assert xml.find('./{*}test/{*}settings/{*}debug').text == 'disable'
+    assert apteryx.get('/test/settings/priority') == '1'
+    xml = m.get_config(source='running', filter=('xpath', '/test/settings/priority')).data
+    assert xml.find('./{*}test/{*}settings/{*}priority').text == '1'
+    m.commit()
+    assert apteryx.get('/test/settings/priority') == '6'
+    assert apteryx.get('/test/settings/debug') == 'disable'
+    m.unlock(target='candidate')
+    m.close_session()
+
+
+def test_edit_config_candidate_delete_discard():
+    """
+    Delete in the candidate then discard it, running keeps the data throughout.
+    """
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+      <priority xc:operation="delete"/>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    m.edit_config(target='candidate', config=payload)
+    xml = m.get_config(source='candidate', filter=('xpath', '/test/settings/priority')).data
+    assert xml.find('./{*}test/{*}settings/{*}priority') is None
+    with pytest.raises(RPCError) as err:
+        m.edit_config(target='candidate', config=payload)
+    assert err.value.tag == 'data-missing'
+    m.discard_changes()
+    xml = m.get_config(source='candidate', filter=('xpath', '/test/settings/priority')).data
+    assert xml.find('./{*}test/{*}settings/{*}priority').text == '1'
+    m.commit()
+    assert apteryx.get('/test/settings/priority') == '1'
+    m.close_session()
+
+
+def test_edit_config_candidate_replaced_condition():
+    """
+    A condition staged with data that a later edit deletes is not checked on commit.
+    """
+    apteryx.set("/test/animals/animal/wombat/name", "wombat")
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+        <animal>
+            <name>cat</name>
+            <claws>5</claws>
+        </animal>
+    </animals>
+  </test>
+</config>
+"""
+    m = connect()
+    m.edit_config(target='candidate', config=payload)
+    delete = payload.replace("<animal>", '<animal xc:operation="delete">').replace("<claws>5</claws>", "")
+    m.edit_config(target='candidate', config=delete)
+    apteryx.prune("/test/animals/animal/wombat")
+    assert m.commit().ok
+    assert apteryx.get('/test/animals/animal/cat/name') is None
+    m.close_session()
+
+
+def test_edit_config_cdata_value():
+    """
+    Set a value given as a CDATA section.
+    """
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+      <priority><![CDATA[5]]></priority>
+    </settings>
+  </test>
+</config>
+"""
+    xml = _edit_config_test(payload, post_xpath='/test/settings/priority')
+    assert xml.find('./{*}test/{*}settings/{*}priority').text == '5'
+
+
+def test_edit_config_list_bulk():
+    """
+    Create enough list entries in one edit for the siblings to be decoded in parallel.
+    """
+    animals = "".join("<animal><name>bulk{}</name><type>little</type></animal>".format(i) for i in range(100))
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>{}</animals>
+  </test>
+</config>
+""".format(animals)
+    _edit_config_test(payload, post_xpath="/test/animals", inc_str=["bulk0", "bulk50", "bulk99"])
+    # run.sh starts the daemon with a decode pool, so every entry was decoded
+    # on it and merged back; run with -v to see the pool in the debug output
+    for i in range(100):
+        assert apteryx.get("/test/animals/animal/bulk{}/name".format(i)) == "bulk{}".format(i)
+
+
+def test_edit_config_list_bulk_invalid():
+    """
+    A bad entry in a large edit fails the whole edit and nothing is written.
+    """
+    animals = "".join("<animal><name>bulk{}</name><type>little</type></animal>".format(i) for i in range(100))
+    animals += "<animal><name>bulk100</name><missing>red</missing></animal>"
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>{}</animals>
+  </test>
+</config>
+""".format(animals)
+    _edit_config_test(payload, expect_err={"tag": "malformed-message", "type": "rpc"})
+    assert apteryx.get("/test/animals/animal/bulk0/name") is None
+
+
+def test_edit_config_test_only():
+    """
+    A test-only edit is checked but nothing is written.
+    """
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+      <priority>2</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    response = m.edit_config(target='running', config=payload, test_option='test-only')
+    print(response)
+    assert response.ok
+    m.close_session()
+    assert apteryx.get("/test/settings/priority") == "1"
+
+
+def test_edit_config_test_only_invalid():
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <state>
+        <counter>7734</counter>
+    </state>
+  </test>
+</config>
+"""
+    m = connect()
+    with pytest.raises(RPCError) as err:
+        m.edit_config(target='running', config=payload, test_option='test-only')
+    _error_check(err.value, {"tag": "invalid-value", "type": "protocol"})
+    m.close_session()
+
+
+def test_edit_config_test_then_set():
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+      <priority>2</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    response = m.edit_config(target='running', config=payload, test_option='test-then-set')
+    print(response)
+    assert response.ok
+    m.close_session()
+    assert apteryx.get("/test/settings/priority") == "2"
+
+
+def test_validate_config():
+    """
+    Validate an inline config without writing it, then one with a bad value.
+    """
+    payload = """
+<config xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test xmlns="http://test.com/ns/yang/testing">
+    <settings>
+      <priority>2</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    response = m.validate(source=etree.fromstring(payload))
+    print(response)
+    assert response.ok
+    assert apteryx.get("/test/settings/priority") == "1"
+    payload = payload.replace("<settings>", "<state>").replace("</settings>", "</state>")
+    payload = payload.replace("<priority>2</priority>", "<counter>7734</counter>")
+    with pytest.raises(RPCError) as err:
+        m.validate(source=etree.fromstring(payload))
+    _error_check(err.value, {"tag": "invalid-value", "type": "protocol"})
+    m.close_session()
+
+
+def test_validate_datastores():
+    m = connect()
+    assert m.validate(source='running').ok
+    assert m.validate(source='candidate').ok
+    assert m.validate(source='startup').ok
+    with pytest.raises(RPCError) as err:
+        m.validate(source='intended')
+    _error_check(err.value, {"tag": "operation-not-supported", "type": "protocol"})
+    m.close_session()
+
+
+def _error_option_test(option):
+    """
+    Send an edit with one good and two bad leaves using the given error-option,
+    returning the errors in the reply.
+    """
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+      <missing>1</missing>
+      <priority>3</priority>
+    </settings>
+    <state>
+      <counter>7734</counter>
+    </state>
+  </test>
+</config>
+"""
+    m = connect()
+    with pytest.raises(RPCError) as err:
+        m.edit_config(target='running', config=payload, error_option=option)
+    m.close_session()
+    return err.value.errors if err.value.errors else [err.value]
+
+
+def test_edit_config_stop_on_error():
+    errors = _error_option_test('stop-on-error')
+    assert len(errors) == 1
+    assert apteryx.get("/test/settings/priority") == "1"
+
+
+def test_edit_config_rollback_on_error():
+    errors = _error_option_test('rollback-on-error')
+    assert len(errors) == 1
+    assert apteryx.get("/test/settings/priority") == "1"
+
+
+def test_edit_config_continue_on_error():
+    """
+    The good leaf is set and both bad leaves are reported in the one reply.
+    """
+    errors = _error_option_test('continue-on-error')
+    assert len(errors) == 2
+    assert errors[0].tag == "malformed-message"
+    assert errors[1].tag == "invalid-value"
+    assert apteryx.get("/test/settings/priority") == "3"
+
+
+def test_edit_config_pipelined():
+    """
+    Send a burst of edits without waiting for the replies. Each gets its own
+    ok and the last value sent wins.
+    """
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <animals>
+      <animal>
+        <name>burst{}</name>
+      </animal>
+    </animals>
+    <settings>
+      <priority>{}</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    m.async_mode = True
+    rpcs = [m.edit_config(target='running', config=payload.format(i, i)) for i in range(2, 8)]
+    for rpc in rpcs:
+        rpc.event.wait(10)
+        assert rpc.reply is not None
+        assert rpc.reply.ok
+    m.async_mode = False
+    m.close_session()
+    assert apteryx.get("/test/settings/priority") == "7"
+    assert apteryx.get("/test/animals/animal/burst2/name") == "burst2"
+    assert apteryx.get("/test/animals/animal/burst7/name") == "burst7"
+
+
+def test_edit_config_pipelined_error():
+    """
+    An edit that fails straight away, sent behind one that may be held back,
+    must not be answered first. Both replies arrive and the good edit is made.
+    """
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+      <priority>{}</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    m.async_mode = True
+    m.raise_mode = RaiseMode.NONE
+    good = m.edit_config(target='running', config=payload.format(5))
+    bad = m.edit_config(target='running', config=payload.format(6), default_operation='bogus')
+    good.event.wait(10)
+    bad.event.wait(10)
+    assert good.reply is not None
+    assert good.reply.ok
+    assert bad.reply is not None
+    assert not bad.reply.ok
+    assert bad.reply.error.tag == "invalid-value"
+    m.async_mode = False
+    m.close_session()
+    assert apteryx.get("/test/settings/priority") == "5"
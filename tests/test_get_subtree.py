@@ -1,5 +1,6 @@
 import pytest
 import apteryx
+from ncclient.operations import RPCError
 from ncclient.xml_ import to_ele
 from lxml import etree
 from conftest import connect, _get_test_with_filter
@@ -956,3 +957,62 @@ def test_get_subtree_double_ampersand_in_value():
     colour = xml.find('.//{*}colour')
     assert colour is not None
     assert colour.text == 'black&&white'
+
+
+def _get_max_depth(select, depth):
+    m = connect()
+    rpc = """
+<get xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <filter type="subtree">%s</filter>
+  <max-depth>%s</max-depth>
+</get>""" % (select, depth)
+    xml = to_ele(m.rpc(to_ele(rpc)).xml)
+    m.close_session()
+    return xml
+
+
+def test_get_subtree_max_depth_leaves_only():
+    select = '<test xmlns="http://test.com/ns/yang/testing"><state/></test>'
+    xml = _get_max_depth(select, 2)
+    assert xml.find('.//{*}state/{*}counter').text == '42'
+    # Containers at the limit are returned without their contents
+    uptime = xml.find('.//{*}state/{*}uptime')
+    assert uptime is not None
+    assert len(uptime) == 0
+
+
+def test_get_subtree_max_depth_selected_only():
+    select = '<test xmlns="http://test.com/ns/yang/testing"><state/></test>'
+    xml = _get_max_depth(select, 1)
+    state = xml.find('.//{*}test/{*}state')
+    assert state is not None
+    assert len(state) == 0
+
+
+def test_get_subtree_max_depth_nested():
+    select = '<test xmlns="http://test.com/ns/yang/testing"><state/></test>'
+    xml = _get_max_depth(select, 3)
+    assert xml.find('.//{*}state/{*}counter').text == '42'
+    assert xml.find('.//{*}state/{*}uptime/{*}days').text == '5'
+
+
+def test_get_subtree_max_depth_list_keys():
+    select = '<test xmlns="http://test.com/ns/yang/testing"><animals/></test>'
+    xml = _get_max_depth(select, 2)
+    names = [n.text for n in xml.findall('.//{*}animal/{*}name')]
+    assert 'cat' in names and 'hamster' in names
+    assert xml.find('.//{*}animal/{*}type') is None
+    assert xml.find('.//{*}animal/{*}food') is None
+
+
+def test_get_subtree_max_depth_unbounded():
+    select = '<test xmlns="http://test.com/ns/yang/testing"><state/></test>'
+    xml = _get_max_depth(select, 'unbounded')
+    assert xml.find('.//{*}state/{*}uptime/{*}seconds').text == '20'
+
+
+def test_get_subtree_max_depth_invalid():
+    select = '<test xmlns="http://test.com/ns/yang/testing"><state/></test>'
+    with pytest.raises(RPCError) as err:
+        _get_max_depth(select, 0)
+    assert err.value.tag == 'invalid-value'
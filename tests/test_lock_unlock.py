@@ -61,9 +61,25 @@ def test_lock_ok():
     m.close_session()
 
 
-@mark.skip(reason="requires candidate datastore")
 def test_lock_candidate():
-    pass
+    m = connect()
+    response = None
+
+    # Lock target datastore
+    response = m.lock(target="candidate")
+    assert response.ok is True
+    match = re.search(OK_REGEX_PATTERN, response.xml)
+    assert match.group() == OK_REGEX_PATTERN
+
+    # Unlock target datastore
+    response = None
+    match = None
+    response = m.unlock(target="candidate")
+    assert response.ok is True
+    match = re.search(OK_REGEX_PATTERN, response.xml)
+    assert match.group() == OK_REGEX_PATTERN
+
+    m.close_session()
 
 
 def test_lock_unlock_ok():
@@ -105,14 +121,48 @@ def test_unlock_fail():
     m.close_session()
 
 
-@mark.skip(reason="requires candidate datastore")
 def test_lock_candidate_unlock_running():
-    pass
+    m = connect()
+
+    # Lock target datastore
+    response = m.lock(target="candidate")
+    assert response.ok is True
+
+    # Unlock a different datastore
+    response = None
+    try:
+        response = m.unlock(target="running")
+    except Exception as e:
+        assert e.tag == "operation-failed"
+        assert e.type == "protocol"
+    assert response is None
+
+    response = m.unlock(target="candidate")
+    assert response.ok is True
+
+    m.close_session()
 
 
-@mark.skip(reason="requires candidate datastore")
 def test_lock_running_unlock_candidate():
-    pass
+    m = connect()
+
+    # Lock target datastore
+    response = m.lock(target="running")
+    assert response.ok is True
+
+    # Unlock a different datastore
+    response = None
+    try:
+        response = m.unlock(target="candidate")
+    except Exception as e:
+        assert e.tag == "operation-failed"
+        assert e.type == "protocol"
+    assert response is None
+
+    response = m.unlock(target="running")
+    assert response.ok is True
+
+    m.close_session()
 
 
 def test_lock_unlock_twice_ok():
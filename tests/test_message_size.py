@@ -2,8 +2,10 @@ import socket
 import os
 import select
 import re
+import time
+import apteryx
 
-# Must match MAX_REQUEST_MESSAGE_SIZE in netconf.c
+# Must match NETCONF_MAX_REQUEST_DEF in netconf.c
 MAX_REQUEST_MESSAGE_SIZE = 32768
 
 
@@ -183,3 +185,44 @@ def test_negative_chunk_size():
     sock2.close()
     assert 'rpc-reply' in result2
     assert 'urn:uuid:cccccccc-0000-0000-0000-000000000000' in result2
+
+
+def test_large_message_with_raised_limit():
+    """
+    Raising /netconf/config/max-request-size lets a session send a request
+    well over the default. Anything larger than 64K is handed to the parser
+    as it arrives rather than buffered whole, so pad a <nc:get/> with a
+    comment to take it past that point over several chunks. Clearing the
+    setting must put the default limit back.
+    """
+    cwd = os.getcwd()
+    unix_path = cwd + '/.build/apteryx-netconf.sock'
+    apteryx.set("/netconf/config/max-request-size", "262144")
+    time.sleep(0.1)
+    assert apteryx.get("/netconf/state/max-request-size") == "262144"
+    try:
+        sock = _connect_and_hello(unix_path)
+        sock.setblocking(1)
+        rpc_xml = '<?xml version="1.0" encoding="UTF-8"?><nc:rpc ' \
+                  'xmlns:nc="urn:ietf:params:xml:ns:netconf:base:1.0" ' \
+                  'message-id="urn:uuid:dddddddd-0000-0000-0000-000000000000">' \
+                  '<!--' + 'A' * 150000 + '--><nc:get/></nc:rpc>'
+        data = rpc_xml.encode()
+        for i in range(0, len(data), 30000):
+            chunk = data[i:i + 30000]
+            sock.sendall('\n#{0}\n'.format(len(chunk)).encode() + chunk)
+        sock.sendall(b'\n##\n')
+        result = _recv_until(sock, b'\n##\n').decode('utf-8')
+        sock.close()
+        assert 'rpc-reply' in result
+        assert 'rpc-error' not in result
+        assert 'urn:uuid:dddddddd-0000-0000-0000-000000000000' in result
+    finally:
+        apteryx.set("/netconf/config/max-request-size", "")
+        time.sleep(0.1)
+
+    sock = _connect_and_hello(unix_path)
+    sock.send('\n#{0}\n'.format(MAX_REQUEST_MESSAGE_SIZE + 1).encode())
+    result = _recv_until(sock, b'\n##\n').decode('utf-8')
+    sock.close()
+    assert 'too-big' in result
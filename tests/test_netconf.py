@@ -1,6 +1,15 @@
+import hashlib
+import os
+import re
+import socket
+import tempfile
+import time
+import apteryx
 from ncclient.operations import RPCError
+from ncclient.xml_ import to_ele
 from lxml import etree
 from conftest import connect
+from test_chunk_header import _connect_and_hello, _recv_until
 
 # CAPABILITIES
 
@@ -11,15 +20,16 @@ def test_server_capabilities():
         print("Capability: %s" % capability)
     assert ":base" in m.server_capabilities
     assert ":writable-running" in m.server_capabilities
-    # assert ":startup" in m.server_capabilities
+    assert ":startup" in m.server_capabilities
     assert ":xpath" in m.server_capabilities
     assert ":with-defaults" in m.server_capabilities
+    assert ":candidate" in m.server_capabilities
+    assert ":validate" in m.server_capabilities
+    assert ":rollback-on-error" in m.server_capabilities
+    assert "urn:alliedtelesis:params:netconf:capability:get-changes:1.0" in m.server_capabilities
 
-    assert ":candidate" not in m.server_capabilities
-    assert ":rollback-on-error" not in m.server_capabilities
     assert ":url" not in m.server_capabilities
     assert ":confirmed-commit" not in m.server_capabilities
-    assert ":validate" not in m.server_capabilities
     assert ":power-control" not in m.server_capabilities
     assert ":notification" not in m.server_capabilities
     assert ":interleave" not in m.server_capabilities
@@ -72,7 +82,7 @@ def test_rpc_ok():
 def test_rpc_error():
     m = connect()
     try:
-        m.get_config(source='candidate', filter=('xpath', "/test/settings/debug"))
+        m.get_config(source='intended', filter=('xpath', "/test/settings/debug"))
     except RPCError as e:
         reply = e
     xml = reply.xml.getparent()
@@ -99,7 +109,105 @@ def test_get_config_unsupported_datastore():
     m = connect()
     response = None
     try:
-        response = m.get_config(source='candidate', filter=('xpath', "/test/settings/debug"))
+        response = m.get_config(source='intended', filter=('xpath', "/test/settings/debug"))
+    except RPCError as err:
+        print(err)
+        assert err.tag == 'operation-not-supported'
+    assert response is None, 'Should have received an RPCError'
+    m.close_session()
+
+
+def test_copy_config_running_to_startup():
+    m = connect()
+    m.delete_config(target='startup')
+    xml = m.get_config(source='startup').data
+    assert xml.find('./{*}test') is None
+    assert m.copy_config(source='running', target='startup').ok
+    xml = m.get_config(source='startup', filter=('xpath', "/test/settings/debug")).data
+    print(etree.tostring(xml, pretty_print=True, encoding="unicode"))
+    assert xml.find('./{*}test/{*}settings/{*}debug').text == 'enable'
+    # Startup keeps what was saved when running changes
+    apteryx.set("/test/settings/debug", "disable")
+    xml = m.get_config(source='startup', filter=('xpath', "/test/settings/debug")).data
+    assert xml.find('./{*}test/{*}settings/{*}debug').text == 'enable'
+    m.delete_config(target='startup')
+    m.close_session()
+
+
+def test_copy_config_startup_after_edits():
+    m = connect()
+    m.delete_config(target='startup')
+    assert m.copy_config(source='running', target='startup').ok
+    payload = """
+<config xmlns:xc="urn:ietf:params:xml:ns:netconf:base:1.0"
+        xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <test>
+    <settings>
+        <priority>%s</priority>
+    </settings>
+  </test>
+</config>
+"""
+    # Each save only adds what changed since the one before
+    assert m.edit_config(target='running', config=payload % '3').ok
+    assert m.copy_config(source='running', target='startup').ok
+    assert m.edit_config(target='running', config=payload % '4').ok
+    xml = m.get_config(source='startup', filter=('xpath', "/test/settings")).data
+    print(etree.tostring(xml, pretty_print=True, encoding="unicode"))
+    assert xml.find('./{*}test/{*}settings/{*}priority').text == '3'
+    assert xml.find('./{*}test/{*}settings/{*}debug').text == 'enable'
+    deleted = payload.replace("<priority>", '<priority xc:operation="delete">')
+    assert m.edit_config(target='running', config=deleted % '4').ok
+    assert m.copy_config(source='running', target='startup').ok
+    xml = m.get_config(source='startup', filter=('xpath', "/test/settings")).data
+    print(etree.tostring(xml, pretty_print=True, encoding="unicode"))
+    assert xml.find('./{*}test/{*}settings/{*}priority') is None
+    assert xml.find('./{*}test/{*}settings/{*}debug').text == 'enable'
+    assert m.validate(source='startup').ok
+    m.delete_config(target='startup')
+    m.close_session()
+
+
+def test_copy_config_startup_after_apteryx_set():
+    m = connect()
+    m.delete_config(target='startup')
+    assert m.copy_config(source='running', target='startup').ok
+    # Changes made outside NETCONF are saved too, with the value running has
+    apteryx.set("/test/settings/priority", "7")
+    apteryx.set("/test/settings/priority", "8")
+    apteryx.set("/test/state/counter", "45")
+    time.sleep(0.1)
+    assert m.copy_config(source='running', target='startup').ok
+    xml = m.get_config(source='startup', filter=('xpath', "/test")).data
+    assert xml.find('./{*}test/{*}settings/{*}priority').text == '8'
+    assert xml.find('./{*}test/{*}state') is None
+    m.delete_config(target='startup')
+    m.close_session()
+
+
+def test_copy_config_unsupported():
+    m = connect()
+    response = None
+    try:
+        response = m.copy_config(source='startup', target='running')
+    except RPCError as err:
+        print(err)
+        assert err.tag == 'operation-not-supported'
+    assert response is None, 'Should have received an RPCError'
+    m.close_session()
+
+
+def test_delete_config_startup():
+    m = connect()
+    assert m.copy_config(source='running', target='startup').ok
+    assert m.delete_config(target='startup').ok
+    xml = m.get_config(source='startup').data
+    assert xml.find('./{*}test') is None
+    # Deleting an empty startup is not an error
+    assert m.delete_config(target='startup').ok
+    response = None
+    try:
+        response = m.delete_config(target='running')
     except RPCError as err:
         print(err)
         assert err.tag == 'operation-not-supported'
@@ -119,7 +227,249 @@ def test_get_config_no_state():
     # Ignore the rest!
     m.close_session()
 
+
+def _get_config_etag(m, select, if_none_match=None):
+    rpc = """
+<get-config xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">
+  <source><running/></source>
+  <filter type="xpath" select="%s"/>
+  %s
+</get-config>""" % (select, "<if-none-match>%s</if-none-match>" % if_none_match if if_none_match else "")
+    return to_ele(m.rpc(to_ele(rpc)).xml).find('./{*}data')
+
+
+def test_get_config_etag_not_modified():
+    m = connect()
+    data = _get_config_etag(m, "/test/settings/debug")
+    etag = data.get('etag')
+    assert etag is not None
+    assert data.find('./{*}test/{*}settings/{*}debug').text == 'enable'
+    data = _get_config_etag(m, "/test/settings/debug", etag)
+    assert data.get('etag') == etag
+    assert data.get('not-modified') == 'true'
+    assert len(data) == 0
+    m.close_session()
+
+
+def test_get_config_etag_changes_on_edit():
+    config = """
+<config>
+  <test xmlns="http://test.com/ns/yang/testing">
+    <settings>
+        <priority>5</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    etag = _get_config_etag(m, "/test/settings/priority").get('etag')
+    m.edit_config(target='running', config=config)
+    data = _get_config_etag(m, "/test/settings/priority", etag)
+    assert data.get('etag') != etag
+    assert data.get('not-modified') is None
+    assert data.find('./{*}test/{*}settings/{*}priority').text == '5'
+    m.close_session()
+
+
+def test_get_config_etag_changes_on_apteryx_set():
+    m = connect()
+    etag = _get_config_etag(m, "/test/settings/priority").get('etag')
+    apteryx.set("/test/settings/priority", "3")
+    time.sleep(0.1)
+    data = _get_config_etag(m, "/test/settings/priority", etag)
+    assert data.get('etag') != etag
+    assert data.find('./{*}test/{*}settings/{*}priority').text == '3'
+    m.close_session()
+
+
+def test_get_config_etag_ignores_state():
+    m = connect()
+    etag = _get_config_etag(m, "/test").get('etag')
+    apteryx.set("/test/state/counter", "43")
+    time.sleep(0.1)
+    data = _get_config_etag(m, "/test", etag)
+    assert data.get('etag') == etag
+    assert data.get('not-modified') == 'true'
+    m.close_session()
+
 # TODO VALIDATE
 # TODO COPY-CONFIG
 # TODO DELETE-CONFIG
 # TODO LOCK/UNLOCK
+
+
+# GET-CHANGES
+
+
+def _get_changes(m, since=None):
+    rpc = '<get-changes xmlns="urn:alliedtelesis:params:xml:ns:netconf:get-changes:1.0">%s</get-changes>' % \
+        ("<since>%s</since>" % since if since else "")
+    return to_ele(m.rpc(to_ele(rpc)).xml)
+
+
+def test_get_changes_resync_without_token():
+    m = connect()
+    xml = _get_changes(m)
+    assert xml.find('./{*}resync-required') is not None
+    assert xml.find('./{*}sync-token').text
+    xml = _get_changes(m, "00000000-0")
+    assert xml.find('./{*}resync-required') is not None
+    m.close_session()
+
+
+def test_get_changes_since_token():
+    m = connect()
+    token = _get_changes(m).find('./{*}sync-token').text
+    apteryx.set("/test/settings/priority", "4")
+    apteryx.set("/test/settings/volume", "")
+    time.sleep(0.1)
+    xml = _get_changes(m, token)
+    assert xml.find('./{*}resync-required') is None
+    assert xml.find('./{*}data/{*}test/{*}settings/{*}priority').text == '4'
+    assert xml.find('./{*}data/{*}test/{*}settings/{*}debug') is None
+    assert '/test/settings/volume' in [d.text for d in xml.findall('./{*}deleted')]
+    token = xml.find('./{*}sync-token').text
+    xml = _get_changes(m, token)
+    assert xml.find('./{*}resync-required') is None
+    assert len(xml.find('./{*}data')) == 0
+    m.close_session()
+
+
+def test_get_changes_records_each_change_once():
+    config = """
+<config>
+  <test xmlns="http://test.com/ns/yang/testing">
+    <settings>
+        <priority>6</priority>
+    </settings>
+  </test>
+</config>
+"""
+    m = connect()
+    token = _get_changes(m).find('./{*}sync-token').text
+    apteryx.set("/test/state/counter", "44")
+    m.edit_config(target='running', config=config)
+    xml = _get_changes(m, token)
+    assert xml.find('./{*}data/{*}test/{*}settings/{*}priority').text == '6'
+    assert xml.find('./{*}data/{*}test/{*}state') is None
+    # One config leaf changed, so the sequence moves on by exactly one
+    seq = int(token.split('-')[1])
+    assert int(xml.find('./{*}sync-token').text.split('-')[1]) == seq + 1
+    m.close_session()
+
+
+# EXPORT
+
+
+def _export(body, fds=None):
+    """
+    Send an export request over a local session, optionally passing
+    descriptors with it, and return the reply.
+    """
+    sock = _connect_and_hello(os.getcwd() + '/.build/apteryx-netconf.sock')
+    rpc = '<?xml version="1.0" encoding="UTF-8"?><nc:rpc ' \
+          'xmlns:nc="urn:ietf:params:xml:ns:netconf:base:1.0" message-id="1">' \
+          '<export>%s</export></nc:rpc>' % body
+    data = rpc.encode()
+    frame = b'\n#%d\n' % len(data) + data + b'\n##\n'
+    if fds:
+        socket.send_fds(sock, [frame], fds)
+    else:
+        sock.send(frame)
+    result = _recv_until(sock, b'\n##\n').decode('utf-8')
+    sock.close()
+    print(result)
+    return result
+
+
+def _export_check(result, content):
+    size = int(re.search('bytes>([0-9]+)<', result).group(1))
+    checksum = re.search('checksum>([0-9a-f]+)<', result).group(1)
+    assert size == len(content)
+    assert checksum == hashlib.sha256(content).hexdigest()
+    assert b'<debug>enable</debug>' in content
+    assert b'<name>cat</name>' in content
+    assert b'<counter>' not in content
+    assert b'<uptime>' not in content
+
+
+def test_export_to_descriptor():
+    with tempfile.TemporaryFile() as f:
+        result = _export('<fd/>', [f.fileno()])
+        f.seek(0)
+        _export_check(result, f.read())
+
+
+def test_export_to_file():
+    path = os.getcwd() + '/.build/export-test.xml'
+    result = _export('<file>export-test.xml</file>')
+    with open(path, 'rb') as f:
+        _export_check(result, f.read())
+    os.remove(path)
+
+
+def test_export_invalid():
+    assert 'invalid-value' in _export('<file>../export-test.xml</file>')
+    assert 'invalid-value' in _export('<fd/>')
+    assert 'missing-element' in _export('')
+
+
+def test_export_remote_denied():
+    m = connect()
+    response = None
+    try:
+        response = m.rpc(to_ele("<export><file>export-test.xml</file></export>"))
+    except RPCError as err:
+        print(err)
+        assert err.tag == 'access-denied'
+    assert response is None, 'Should have received an RPCError'
+    m.close_session()
+
+
+# COPY-CONFIG FROM URL
+
+
+def _copy_from_url(m, url):
+    rpc = "<copy-config><target><running/></target><source><url>%s</url></source></copy-config>" % url
+    return m.rpc(to_ele(rpc))
+
+
+def test_copy_config_from_url():
+    path = os.getcwd() + '/.build/restore-test.xml'
+    assert 'rpc-error' not in _export('<file>restore-test.xml</file>')
+    apteryx.set("/test/settings/priority", "4")
+    apteryx.set("/test/settings/volume", "")
+    apteryx.set("/test/animals/animal/frog/name", "frog")
+    m = connect()
+    assert _copy_from_url(m, 'file://' + path).ok
+    m.close_session()
+    os.remove(path)
+    assert apteryx.get("/test/settings/priority") == "1"
+    assert apteryx.get("/test/settings/volume") == "1"
+    assert apteryx.get("/test/animals/animal/frog/name") is None
+    # Only config is replaced
+    assert apteryx.get("/test/state/counter") == "42"
+    assert apteryx.get("/test/settings/hidden") == "friend"
+
+
+def test_copy_config_from_url_invalid():
+    path = os.getcwd() + '/.build/restore-test.xml'
+    with open(path, 'w') as f:
+        f.write('<config xmlns="urn:ietf:params:xml:ns:netconf:base:1.0">'
+                '<test xmlns="http://test.com/ns/yang/testing"><state><counter>7734</counter></state></test>'
+                '</config>')
+    m = connect()
+    for url, tag in [('file://' + path, 'invalid-value'),
+                     ('file:///etc/passwd', 'invalid-value'),
+                     ('http://localhost/restore-test.xml', 'invalid-value')]:
+        response = None
+        try:
+            response = _copy_from_url(m, url)
+        except RPCError as err:
+            print(err)
+            assert err.tag == tag
+        assert response is None, 'Should have received an RPCError'
+    m.close_session()
+    os.remove(path)
+    assert apteryx.get("/test/state/counter") == "42"
+    assert apteryx.get("/test/settings/priority") == "1"